@@ -0,0 +1,101 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "avatarcache.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+
+#include "mediacache.h"
+#include "quaternionconnection.h"
+
+namespace
+{
+    // Enough for a few thousand small avatars
+    const int MemoryBudget = 8 * 1024 * 1024;
+    // A failed avatar is requested again on a repaint after this long
+    const qint64 RetryDelay = 60 * 1000;
+}
+
+AvatarCache::AvatarCache(QuaternionConnection* connection, QObject* parent)
+    : QObject(parent)
+    , m_connection(connection)
+    , m_pixmaps(MemoryBudget)
+{
+}
+
+AvatarCache::~AvatarCache()
+{
+}
+
+QPixmap AvatarCache::avatar(const QUrl& mxcUrl, const QSize& size)
+{
+    if( mxcUrl.isEmpty() || size.isEmpty() )
+        return QPixmap();
+
+    const QString k = key(mxcUrl, size);
+    if( QPixmap* pixmap = m_pixmaps.object(k) )
+        return *pixmap;
+    if( m_requested.contains(k) )
+        return QPixmap();
+    auto failed = m_failed.find(k);
+    if( failed != m_failed.end() )
+    {
+        // A failure may be a passing network problem; retried after a while
+        if( QDateTime::currentMSecsSinceEpoch() - failed.value() < RetryDelay )
+            return QPixmap();
+        m_failed.erase(failed);
+    }
+
+    // Several avatar sizes share one thumbnail of the media cache
+    const QString mediaId = mxcUrl.host() + mxcUrl.path();
+    MediaRequest* request =
+        m_connection->mediaCache()->request(mediaId, MediaCache::sizeBucket(size, 1));
+    m_requested.insert(k);
+    connect( request, &MediaRequest::finished, this,
+             [this, k, mxcUrl, size](QImage image) { gotAvatar(k, mxcUrl, size, image); } );
+    return QPixmap();
+}
+
+void AvatarCache::gotAvatar(const QString& key, const QUrl& mxcUrl, const QSize& size,
+                            const QImage& image)
+{
+    m_requested.remove(key);
+    if( image.isNull() )
+    {
+        // Kept so that repaints don't retry it every time
+        m_failed.insert(key, QDateTime::currentMSecsSinceEpoch());
+        qDebug() << "Failed to load avatar" << mxcUrl;
+        return;
+    }
+
+    // The thumbnail is only roughly of the requested size
+    QPixmap pixmap = QPixmap::fromImage(image);
+    // Avatars are laid out in logical pixels at the requested size
+    pixmap.setDevicePixelRatio(1);
+    if( pixmap.size() != size )
+        pixmap = pixmap.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    m_pixmaps.insert(key, new QPixmap(pixmap), pixmap.width() * pixmap.height() * 4);
+    emit avatarReady(mxcUrl);
+}
+
+QString AvatarCache::key(const QUrl& mxcUrl, const QSize& size) const
+{
+    return QString("%1#%2x%3").arg(mxcUrl.toString()).arg(size.width()).arg(size.height());
+}
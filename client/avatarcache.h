@@ -0,0 +1,69 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef AVATARCACHE_H
+#define AVATARCACHE_H
+
+#include <QtCore/QCache>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QSet>
+#include <QtCore/QUrl>
+#include <QtGui/QPixmap>
+
+class QuaternionConnection;
+
+/**
+ * Avatars scaled to the sizes they are shown at, shared by all views.
+ * Recently used pixmaps are kept in memory, up to a number of bytes;
+ * the thumbnails they're scaled from are loaded through the connection's
+ * MediaCache, so they survive restarts within its disk quota.
+ */
+class AvatarCache: public QObject
+{
+        Q_OBJECT
+    public:
+        AvatarCache(QuaternionConnection* connection, QObject* parent = nullptr);
+        virtual ~AvatarCache();
+
+        /**
+         * Returns the avatar at the given size, or a null pixmap if it
+         * isn't available yet; in that case it's loaded from disk or the
+         * server and avatarReady() is emitted once it's there.
+         */
+        QPixmap avatar(const QUrl& mxcUrl, const QSize& size);
+
+    signals:
+        void avatarReady(QUrl mxcUrl);
+
+    private:
+        QString key(const QUrl& mxcUrl, const QSize& size) const;
+        void gotAvatar(const QString& key, const QUrl& mxcUrl, const QSize& size,
+                       const QImage& image);
+
+        QuaternionConnection* m_connection;
+        /** Scaled pixmaps by key; the cost is their size in bytes */
+        QCache<QString, QPixmap> m_pixmaps;
+        /** Keys being loaded */
+        QSet<QString> m_requested;
+        /** Keys that failed to load, with when they did, in ms since epoch */
+        QHash<QString, qint64> m_failed;
+};
+
+#endif // AVATARCACHE_H
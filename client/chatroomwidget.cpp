@@ -20,6 +20,8 @@
 #include "chatroomwidget.h"
 
 #include <QtCore/QDebug>
+#include <QtCore/QEvent>
+#include <QtCore/QSettings>
 #include <QtCore/QTimer>
 #include <QtWidgets/QListView>
 #include <QtWidgets/QLineEdit>
@@ -39,17 +41,36 @@
 #include "lib/events/typingevent.h"
 #include "models/messageeventmodel.h"
 #include "quaternionroom.h"
+#include "paginationcontroller.h"
+#include "mediaprefetcher.h"
 #include "imageprovider.h"
+#include "quaternionconnection.h"
+#include "mediacache.h"
+
+namespace
+{
+    // Rooms whose views are kept, unless set otherwise
+    const int DefaultWarmRooms = 5;
+    // Frame times are reported in debug mode after this many frames...
+    const int FramesPerReport = 120;
+    // ...of continuous rendering; a longer pause means the view was idle
+    const qint64 IdleFrameGap = 100;
+}
 
 ChatRoomWidget::ChatRoomWidget(QWidget* parent)
     : QWidget(parent)
 {
-    m_messageModel = new MessageEventModel(this);
+    m_messageModel = nullptr;
+    m_pagination = new PaginationController(this);
+    m_prefetcher = new MediaPrefetcher(this);
     m_currentRoom = nullptr;
     m_currentConnection = nullptr;
+    m_frameCount = 0;
+    m_frameTotal = 0;
+    m_frameWorst = 0;
+    m_warmRoomCount = qMax(1, QSettings().value("timeline/warm_rooms", DefaultWarmRooms).toInt());
 
     //m_messageView = new QListView();
-    //m_messageView->setModel(m_messageModel);
 
     m_quickView = new QQuickView();
 
@@ -59,13 +80,15 @@ ChatRoomWidget::ChatRoomWidget(QWidget* parent)
     QWidget* container = QWidget::createWindowContainer(m_quickView, this);
     container->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
     QQmlContext* ctxt = m_quickView->rootContext();
-    ctxt->setContextProperty("messageModel", m_messageModel);
+    ctxt->setContextProperty("pagination", m_pagination);
+    ctxt->setContextProperty("prefetcher", m_prefetcher);
     ctxt->setContextProperty("debug", QVariant(false));
     m_quickView->setSource(QUrl("qrc:///qml/chat.qml"));
     m_quickView->setResizeMode(QQuickView::SizeRootObjectToView);
 
     QObject* rootItem = m_quickView->rootObject();
-    connect( rootItem, SIGNAL(getPreviousContent()), this, SLOT(getPreviousContent()) );
+    connect( rootItem, SIGNAL(fillGap(int, bool)), this, SLOT(fillGap(int, bool)) );
+    connect( rootItem, SIGNAL(loadAnimation(QString)), this, SLOT(loadAnimation(QString)) );
 
 
     m_chatEdit = new QLineEdit();
@@ -93,6 +116,38 @@ void ChatRoomWidget::enableDebug()
 {
     QQmlContext* ctxt = m_quickView->rootContext();
     ctxt->setContextProperty("debug", true);
+    // Frame times while the timeline scrolls, to compare changes to the
+    // delegate; QSG_RENDER_TIMING=1 breaks each frame down further
+    connect( m_quickView, &QQuickWindow::frameSwapped, this, &ChatRoomWidget::frameSwapped );
+}
+
+void ChatRoomWidget::frameSwapped()
+{
+    const qint64 elapsed = m_frameClock.isValid() ? m_frameClock.restart() : IdleFrameGap;
+    if( !m_frameClock.isValid() )
+        m_frameClock.start();
+    if( elapsed >= IdleFrameGap )
+        return; // The first frame after a pause
+    ++m_frameCount;
+    m_frameTotal += elapsed;
+    m_frameWorst = qMax(m_frameWorst, elapsed);
+    if( m_frameCount < FramesPerReport )
+        return;
+    qDebug() << "Timeline frames:" << m_frameCount << "average"
+             << double(m_frameTotal) / m_frameCount << "ms, worst" << m_frameWorst << "ms";
+    m_frameCount = 0;
+    m_frameTotal = 0;
+    m_frameWorst = 0;
+}
+
+void ChatRoomWidget::changeEvent(QEvent* event)
+{
+    if( event->type() == QEvent::LocaleChange )
+    {
+        for( const RoomView& view: m_roomViews )
+            view.model->invalidateLocaleData();
+    }
+    QWidget::changeEvent(event);
 }
 
 void ChatRoomWidget::setRoom(QMatrixClient::Room* room)
@@ -107,21 +162,96 @@ void ChatRoomWidget::setRoom(QMatrixClient::Room* room)
     {
         connect( m_currentRoom, &QMatrixClient::Room::typingChanged, this, &ChatRoomWidget::typingChanged );
         connect( m_currentRoom, &QMatrixClient::Room::topicChanged, this, &ChatRoomWidget::topicChanged );
+        connect( m_currentRoom, &QuaternionRoom::jumpReady, this, &ChatRoomWidget::jumpReady );
         m_currentRoom->setShown(true);
         topicChanged();
         typingChanged();
     }
-    m_messageModel->changeRoom( room );
-    //m_messageView->scrollToBottom();
+    // Before the view is shown, so that it reports to the new room
+    m_pagination->setRoom( m_currentRoom );
+    QObject* view = nullptr;
+    if( m_currentRoom )
+    {
+        const RoomView& roomView = warmUp(m_currentRoom);
+        m_messageModel = roomView.model;
+        view = roomView.view;
+    }
+    else
+        m_messageModel = nullptr;
+    m_prefetcher->setModel( m_messageModel );
+    QObject* rootItem = m_quickView->rootObject();
+    QMetaObject::invokeMethod(rootItem, "showRoomView", Q_ARG(QVariant, QVariant::fromValue(view)));
+}
+
+const ChatRoomWidget::RoomView& ChatRoomWidget::warmUp(QuaternionRoom* room)
+{
+    m_recentRooms.removeOne(room);
+    m_recentRooms.prepend(room);
+    auto it = m_roomViews.find(room);
+    if( it != m_roomViews.end() )
+        return it.value();
+
+    while( m_recentRooms.size() > m_warmRoomCount )
+        dropRoomView(m_recentRooms.last());
+
+    MessageEventModel* model = new MessageEventModel(this);
+    model->setConnection(m_currentConnection);
+    model->changeRoom(room);
+    QVariant view;
     QObject* rootItem = m_quickView->rootObject();
-    QMetaObject::invokeMethod(rootItem, "scrollToBottom");
+    QMetaObject::invokeMethod(rootItem, "createRoomView", Q_RETURN_ARG(QVariant, view),
+                              Q_ARG(QVariant, QVariant::fromValue<QObject*>(model)));
+    room->setKeptWarm(true);
+    // In the model's context: setRoom() disconnects the room from this
+    // widget, while the view has to be forgotten whenever the room goes
+    connect( room, &QObject::destroyed, model, [this, room] {
+        if( room == m_currentRoom )
+        {
+            m_currentRoom = nullptr;
+            m_pagination->setRoom(nullptr);
+        }
+        forgetRoomView(room);
+    });
+    return m_roomViews.insert(room, { model, view.value<QObject*>() }).value();
+}
+
+void ChatRoomWidget::dropRoomView(QuaternionRoom* room)
+{
+    if( m_roomViews.contains(room) )
+        disconnect( room, &QObject::destroyed, m_roomViews.value(room).model, nullptr );
+    room->setKeptWarm(false);
+    forgetRoomView(room);
+}
+
+void ChatRoomWidget::forgetRoomView(QuaternionRoom* room)
+{
+    m_recentRooms.removeOne(room);
+    if( !m_roomViews.contains(room) )
+        return;
+    const RoomView roomView = m_roomViews.take(room);
+    if( roomView.model == m_messageModel )
+    {
+        m_messageModel = nullptr;
+        m_prefetcher->setModel(nullptr);
+        QObject* rootItem = m_quickView->rootObject();
+        QMetaObject::invokeMethod(rootItem, "showRoomView",
+                                  Q_ARG(QVariant, QVariant::fromValue<QObject*>(nullptr)));
+    }
+    // The view goes first, it uses the model until then
+    roomView.model->changeRoom(nullptr);
+    roomView.view->deleteLater();
+    roomView.model->deleteLater();
 }
 
 void ChatRoomWidget::setConnection(QMatrixClient::Connection* connection)
 {
     m_currentConnection = connection;
     m_imageProvider->setConnection(connection);
-    m_messageModel->setConnection(connection);
+    m_prefetcher->setConnection(connection);
+    // The rooms of the previous connection are gone with it
+    setRoom(nullptr);
+    while( !m_recentRooms.isEmpty() )
+        dropRoomView(m_recentRooms.first());
 }
 
 void ChatRoomWidget::typingChanged()
@@ -145,10 +275,61 @@ void ChatRoomWidget::topicChanged()
     m_topicLabel->setText( m_currentRoom->topic() );
 }
 
-void ChatRoomWidget::getPreviousContent()
+void ChatRoomWidget::scrollToEvent(QString eventId, QDateTime timestamp)
+{
+    if( m_currentRoom )
+        m_currentRoom->jumpToEvent(eventId, timestamp);
+}
+
+void ChatRoomWidget::jumpToReadMarker()
 {
-    if (m_currentRoom)
-        m_currentRoom->getPreviousContent();
+    if( !m_currentRoom || !m_currentConnection )
+        return;
+    const QString eventId = m_currentRoom->lastReadEvent(m_currentConnection->user());
+    if( !eventId.isEmpty() )
+        m_currentRoom->jumpToEvent(eventId);
+}
+
+void ChatRoomWidget::jumpToDate(QDate date)
+{
+    if( m_currentRoom )
+        m_currentRoom->jumpToDate(QDateTime(date));
+}
+
+void ChatRoomWidget::fillGap(int row, bool backwards)
+{
+    if( m_currentRoom && row >= 0 && row < m_currentRoom->messages().size() )
+        m_currentRoom->fillGap(m_currentRoom->messages().at(row), backwards);
+}
+
+void ChatRoomWidget::loadAnimation(QString mediaId)
+{
+    if( !m_currentConnection )
+        return;
+    MediaCache* cache = static_cast<QuaternionConnection*>(m_currentConnection)->mediaCache();
+    auto play = [this, cache, mediaId] {
+        const QString file = cache->localFile(mediaId, 0);
+        if( file.isEmpty() )
+            return;
+        QObject* rootItem = m_quickView->rootObject();
+        QMetaObject::invokeMethod(rootItem, "playAnimation", Q_ARG(QVariant, mediaId),
+                                  Q_ARG(QVariant, QUrl::fromLocalFile(file)));
+    };
+    if( !cache->localFile(mediaId, 0).isEmpty() )
+        play();
+    else
+        connect( cache->request(mediaId, 0), &MediaRequest::finished, this, play );
+}
+
+void ChatRoomWidget::jumpReady(QString eventId)
+{
+    if( !m_messageModel )
+        return;
+    const int row = m_messageModel->rowForEvent(eventId);
+    if( row < 0 )
+        return;
+    QObject* rootItem = m_quickView->rootObject();
+    QMetaObject::invokeMethod(rootItem, "scrollToRow", Q_ARG(QVariant, row));
 }
 
 void ChatRoomWidget::sendLine()
@@ -20,6 +20,10 @@
 #ifndef CHATROOMWIDGET_H
 #define CHATROOMWIDGET_H
 
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
 #include <QtWidgets/QWidget>
 
 #include <QtQuick/QQuickView>
@@ -31,6 +35,8 @@ namespace QMatrixClient
     class Event;
 }
 class MessageEventModel;
+class PaginationController;
+class MediaPrefetcher;
 class QuaternionRoom;
 class ImageProvider;
 class QListView;
@@ -51,16 +57,64 @@ class ChatRoomWidget: public QWidget
         void setConnection(QMatrixClient::Connection* connection);
         void topicChanged();
         void typingChanged();
-        void getPreviousContent();
+        /**
+         * Scrolls the timeline of the current room to the event, loading
+         * it first if needed; the timestamp, if known, helps finding it
+         * among evicted messages.
+         */
+        void scrollToEvent(QString eventId, QDateTime timestamp = QDateTime());
+        void jumpToReadMarker();
+        void jumpToDate(QDate date);
+        void fillGap(int row, bool backwards);
+        /**
+         * Downloads the full image for the view to play its animation;
+         * it's played from the file in the media cache.
+         */
+        void loadAnimation(QString mediaId);
+
+    protected:
+        void changeEvent(QEvent* event) override;
 
     private slots:
         void sendLine();
+        void jumpReady(QString eventId);
 
     private:
+        /**
+         * A room's timeline view in QML and its model. Views of the
+         * most recently shown rooms are kept, hidden, with their
+         * delegates and scroll position, to switch back to instantly.
+         */
+        struct RoomView
+        {
+            MessageEventModel* model;
+            QObject* view;
+        };
+        /** Returns the room's view, creating it and dropping the oldest if needed */
+        const RoomView& warmUp(QuaternionRoom* room);
+        void dropRoomView(QuaternionRoom* room);
+        /** Same but doesn't touch the room, which may be being destroyed */
+        void forgetRoomView(QuaternionRoom* room);
+        /** Collects frame times in debug mode; see enableDebug() */
+        void frameSwapped();
+
+        /** The model of the current room, or nullptr */
         MessageEventModel* m_messageModel;
+        QHash<QuaternionRoom*, RoomView> m_roomViews;
+        /** Rooms with a view, most recently shown first */
+        QList<QuaternionRoom*> m_recentRooms;
+        int m_warmRoomCount;
+        PaginationController* m_pagination;
+        MediaPrefetcher* m_prefetcher;
         QuaternionRoom* m_currentRoom;
         QMatrixClient::Connection* m_currentConnection;
 
+        /** Frame time statistics since the last report, in debug mode */
+        QElapsedTimer m_frameClock;
+        int m_frameCount;
+        qint64 m_frameTotal;
+        qint64 m_frameWorst;
+
         //QListView* m_messageView;
         QQuickView* m_quickView;
         ImageProvider* m_imageProvider;
@@ -0,0 +1,123 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "directorydock.h"
+
+#include <QtCore/QTimer>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QListView>
+#include <QtWidgets/QVBoxLayout>
+
+#include "models/publicroomsmodel.h"
+#include "quaternionconnection.h"
+
+namespace
+{
+    // Search terms are sent once typing pauses for this long
+    const int SearchDelay = 400;
+}
+
+DirectoryDock::DirectoryDock(QWidget* parent)
+    : QDockWidget("Room Directory", parent)
+    , m_connection(nullptr)
+{
+    setFeatures(DockWidgetClosable | DockWidgetMovable | DockWidgetFloatable);
+    setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
+
+    m_model = new PublicRoomsModel(this);
+    m_filterEdit = new QLineEdit();
+    m_filterEdit->setPlaceholderText(tr("Search public rooms"));
+    m_view = new QListView();
+    m_view->setModel(m_model);
+    m_view->setUniformItemSizes(true);
+    m_statusLabel = new QLabel();
+
+    m_searchTimer = new QTimer(this);
+    m_searchTimer->setSingleShot(true);
+    m_searchTimer->setInterval(SearchDelay);
+    connect( m_searchTimer, &QTimer::timeout, this, &DirectoryDock::startSearch );
+    connect( m_filterEdit, &QLineEdit::textChanged, m_searchTimer, static_cast<void (QTimer::*)()>(&QTimer::start) );
+    connect( m_filterEdit, &QLineEdit::returnPressed, this, &DirectoryDock::startSearch );
+    connect( m_view, &QListView::activated, this, &DirectoryDock::roomActivated );
+    connect( m_model, &PublicRoomsModel::loadingChanged, this, &DirectoryDock::updateStatus );
+    connect( m_model, &PublicRoomsModel::modelReset, this, &DirectoryDock::updateStatus );
+    connect( m_model, &PublicRoomsModel::rowsInserted, this, &DirectoryDock::updateStatus );
+    connect( m_model, &PublicRoomsModel::requestFailed, this, &DirectoryDock::requestFailed );
+
+    QWidget* widget = new QWidget();
+    QVBoxLayout* layout = new QVBoxLayout();
+    layout->addWidget(m_filterEdit);
+    layout->addWidget(m_view);
+    layout->addWidget(m_statusLabel);
+    widget->setLayout(layout);
+    setWidget(widget);
+}
+
+DirectoryDock::~DirectoryDock()
+{
+}
+
+void DirectoryDock::setConnection(QuaternionConnection* connection)
+{
+    m_connection = connection;
+    m_model->setConnection(connection);
+    if( isVisible() )
+        m_model->fetchMore(QModelIndex());
+}
+
+void DirectoryDock::showEvent(QShowEvent* event)
+{
+    // Nothing is requested until the directory is actually looked at
+    if( m_model->rowCount() == 0 )
+        m_model->fetchMore(QModelIndex());
+    QDockWidget::showEvent(event);
+}
+
+void DirectoryDock::startSearch()
+{
+    m_searchTimer->stop();
+    m_model->setFilter(m_filterEdit->text().trimmed());
+}
+
+void DirectoryDock::updateStatus()
+{
+    if( m_model->isLoading() )
+        m_statusLabel->setText(tr("Loading..."));
+    else if( m_model->totalEstimate() >= 0 )
+        m_statusLabel->setText(tr("%1 of about %2 rooms")
+                               .arg(m_model->rowCount()).arg(m_model->totalEstimate()));
+    else
+        m_statusLabel->setText(tr("%1 rooms").arg(m_model->rowCount()));
+}
+
+void DirectoryDock::requestFailed(QString error)
+{
+    m_statusLabel->setText(tr("Failed to load rooms: %1").arg(error));
+}
+
+void DirectoryDock::roomActivated(const QModelIndex& index)
+{
+    if( !m_connection || !index.isValid() )
+        return;
+    QString room = index.data(PublicRoomsModel::AliasRole).toString();
+    if( room.isEmpty() )
+        room = index.data(PublicRoomsModel::RoomIdRole).toString();
+    m_connection->joinRoom(room);
+}
@@ -0,0 +1,64 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef DIRECTORYDOCK_H
+#define DIRECTORYDOCK_H
+
+#include <QtWidgets/QDockWidget>
+
+class PublicRoomsModel;
+class QuaternionConnection;
+class QLabel;
+class QLineEdit;
+class QListView;
+class QModelIndex;
+class QTimer;
+
+/**
+ * Browses the public room directory of the homeserver; activating a
+ * room joins it.
+ */
+class DirectoryDock: public QDockWidget
+{
+        Q_OBJECT
+    public:
+        DirectoryDock(QWidget* parent = nullptr);
+        virtual ~DirectoryDock();
+
+        void setConnection( QuaternionConnection* connection );
+
+    protected:
+        void showEvent(QShowEvent* event) override;
+
+    private slots:
+        void startSearch();
+        void updateStatus();
+        void requestFailed(QString error);
+        void roomActivated(const QModelIndex& index);
+
+    private:
+        QuaternionConnection* m_connection;
+        PublicRoomsModel* m_model;
+        QLineEdit* m_filterEdit;
+        QListView* m_view;
+        QLabel* m_statusLabel;
+        QTimer* m_searchTimer;
+};
+
+#endif // DIRECTORYDOCK_H
@@ -0,0 +1,91 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "highlightmatcher.h"
+
+#include <QtCore/QQueue>
+
+HighlightMatcher::HighlightMatcher(const QStringList& keywords)
+{
+    m_nodes.append(Node()); // The root
+
+    // Build the trie of case-folded keywords
+    for( const QString& keyword: keywords )
+    {
+        const QString folded = keyword.toCaseFolded();
+        if( folded.isEmpty() )
+            continue;
+        m_keywords.append(keyword);
+
+        int state = 0;
+        for( QChar c: folded )
+        {
+            int next = m_nodes.at(state).next.value(c, 0);
+            if( next == 0 )
+            {
+                m_nodes.append(Node());
+                next = m_nodes.size() - 1;
+                m_nodes[state].next.insert(c, next);
+            }
+            state = next;
+        }
+        m_nodes[state].terminal = true;
+    }
+
+    // Link each node to the longest proper suffix of its path that is
+    // also in the trie, breadth first so that shorter paths are done first.
+    QQueue<int> queue;
+    for( int child: m_nodes.at(0).next )
+        queue.enqueue(child);
+    while( !queue.isEmpty() )
+    {
+        const int state = queue.dequeue();
+        const QHash<QChar, int> next = m_nodes.at(state).next;
+        for( auto it = next.begin(); it != next.end(); ++it )
+        {
+            int fail = m_nodes.at(state).fail;
+            while( fail != 0 && !m_nodes.at(fail).next.contains(it.key()) )
+                fail = m_nodes.at(fail).fail;
+            Node& child = m_nodes[it.value()];
+            child.fail = m_nodes.at(fail).next.value(it.key(), 0);
+            child.terminal = child.terminal || m_nodes.at(child.fail).terminal;
+            queue.enqueue(it.value());
+        }
+    }
+}
+
+bool HighlightMatcher::matches(const QString& text) const
+{
+    int state = 0;
+    for( QChar c: text )
+    {
+        c = c.toCaseFolded();
+        while( state != 0 && !m_nodes.at(state).next.contains(c) )
+            state = m_nodes.at(state).fail;
+        state = m_nodes.at(state).next.value(c, 0);
+        if( m_nodes.at(state).terminal )
+            return true;
+    }
+    return false;
+}
+
+QStringList HighlightMatcher::keywords() const
+{
+    return m_keywords;
+}
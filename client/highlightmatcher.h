@@ -0,0 +1,53 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef HIGHLIGHTMATCHER_H
+#define HIGHLIGHTMATCHER_H
+
+#include <QtCore/QHash>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+/**
+ * Finds whether a text contains any of a set of keywords, ignoring case.
+ * The keywords are compiled into an Aho-Corasick automaton, so a text is
+ * scanned once no matter how many keywords there are. A matcher is
+ * immutable after construction and can be shared between threads.
+ */
+class HighlightMatcher
+{
+    public:
+        explicit HighlightMatcher(const QStringList& keywords = QStringList());
+
+        bool matches(const QString& text) const;
+        QStringList keywords() const;
+
+    private:
+        struct Node
+        {
+            QHash<QChar, int> next;
+            int fail = 0;
+            bool terminal = false;
+        };
+
+        QVector<Node> m_nodes;
+        QStringList m_keywords;
+};
+
+#endif // HIGHLIGHTMATCHER_H
@@ -0,0 +1,155 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "imagebudget.h"
+
+#include <QtCore/QCache>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSettings>
+#include <QtQuick/QQuickTextureFactory>
+#include <QtQuick/QQuickWindow>
+
+#include "mediacache.h"
+
+namespace
+{
+    // The limit unless set with the "media/decoded_budget_mb" setting
+    const int DefaultBudgetMb = 128;
+    // The smallest bucket fallbacks go down to
+    const int MinBucket = 64;
+
+    // Bucket decisions remembered; a forgotten one is simply made again
+    const int MaxDecisions = 4096;
+
+    struct Charge
+    {
+        int holders;
+        qint64 bytes;
+    };
+
+    QMutex budgetMutex;
+    qint64 usedBytes = 0;
+    /** Charged images by QImage::cacheKey(), shared copies included */
+    QHash<qint64, Charge> charges;
+    /** Decided buckets by media id and unlowered bucket */
+    QCache<QString, int> decisions(MaxDecisions);
+}
+
+/** Keeps the image charged to the budget for as long as QML holds it */
+class BudgetedTextureFactory: public QQuickTextureFactory
+{
+    public:
+        explicit BudgetedTextureFactory(const QImage& image)
+            : m_image(image)
+        { }
+
+        QSGTexture* createTexture(QQuickWindow* window) const override
+        {
+            return window->createTextureFromImage(m_image.image());
+        }
+        QSize textureSize() const override
+        {
+            return m_image.image().size();
+        }
+        int textureByteCount() const override
+        {
+            return m_image.image().byteCount();
+        }
+        QImage image() const override
+        {
+            return m_image.image();
+        }
+
+    private:
+        BudgetedImage m_image;
+};
+
+BudgetedImage::BudgetedImage(const QImage& image)
+    : m_image(image)
+{
+    ImageBudget::charge(m_image);
+}
+
+BudgetedImage::~BudgetedImage()
+{
+    ImageBudget::credit(m_image);
+}
+
+qint64 ImageBudget::limit()
+{
+    static const qint64 limit =
+        qint64(QSettings().value("media/decoded_budget_mb", DefaultBudgetMb).toInt()) * 1024 * 1024;
+    return limit;
+}
+
+qint64 ImageBudget::used()
+{
+    QMutexLocker locker(&budgetMutex);
+    return usedBytes;
+}
+
+int ImageBudget::bucketFor(const QString& mediaId, const QSize& size,
+                           qreal devicePixelRatio)
+{
+    int bucket = MediaCache::sizeBucket(size, devicePixelRatio);
+    if( bucket == 0 )
+        return bucket;
+
+    const QString key = mediaId + '@' + QString::number(bucket);
+    QMutexLocker locker(&budgetMutex);
+    if( int* decided = decisions.object(key) )
+        return *decided;
+    // A square image in 32-bit colour is the most a bucket can take
+    const qint64 available = limit() - usedBytes;
+    while( bucket > MinBucket && qint64(bucket) * bucket * 4 > available )
+        bucket /= 2;
+    decisions.insert(key, new int(bucket));
+    return bucket;
+}
+
+QQuickTextureFactory* ImageBudget::textureFactory(const QImage& image)
+{
+    return new BudgetedTextureFactory(image);
+}
+
+void ImageBudget::charge(const QImage& image)
+{
+    if( image.isNull() )
+        return;
+    QMutexLocker locker(&budgetMutex);
+    Charge& charge = charges[image.cacheKey()];
+    if( charge.holders++ == 0 )
+    {
+        charge.bytes = image.byteCount();
+        usedBytes += charge.bytes;
+    }
+}
+
+void ImageBudget::credit(const QImage& image)
+{
+    if( image.isNull() )
+        return;
+    QMutexLocker locker(&budgetMutex);
+    auto it = charges.find(image.cacheKey());
+    if( it == charges.end() || --it->holders > 0 )
+        return;
+    usedBytes -= it->bytes;
+    charges.erase(it);
+}
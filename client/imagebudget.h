@@ -0,0 +1,76 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef IMAGEBUDGET_H
+#define IMAGEBUDGET_H
+
+#include <QtCore/QSize>
+#include <QtGui/QImage>
+
+class QQuickTextureFactory;
+
+/**
+ * Bytes of decoded images held by QML and by the MediaCache memory tier,
+ * across all views. Images are charged while a BudgetedImage holds them;
+ * an image held in several places (e.g. the cache and a texture factory)
+ * is charged once. While the budget is exhausted, new images are
+ * requested at lower resolutions. The limit comes from the
+ * "media/decoded_budget_mb" setting. Thread-safe.
+ */
+class ImageBudget
+{
+    public:
+        static qint64 limit();
+        static qint64 used();
+
+        /**
+         * The MediaCache bucket for the media shown at the given size:
+         * MediaCache::sizeBucket(), lowered until the image fits in
+         * what's left of the budget, down to the smallest bucket. The
+         * bucket is decided on the first call for the media and size;
+         * later calls return the same one whatever the budget is at, so
+         * that the prefetcher and the image provider ask for one entry.
+         */
+        static int bucketFor(const QString& mediaId, const QSize& size,
+                             qreal devicePixelRatio);
+        /** A texture factory that charges the image until it's deleted */
+        static QQuickTextureFactory* textureFactory(const QImage& image);
+
+    private:
+        friend class BudgetedImage;
+        static void charge(const QImage& image);
+        static void credit(const QImage& image);
+};
+
+/** An image charged to the ImageBudget for as long as this lives */
+class BudgetedImage
+{
+    public:
+        explicit BudgetedImage(const QImage& image);
+        ~BudgetedImage();
+
+        const QImage& image() const { return m_image; }
+
+    private:
+        Q_DISABLE_COPY(BudgetedImage)
+
+        QImage m_image;
+};
+
+#endif // IMAGEBUDGET_H
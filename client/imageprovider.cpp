@@ -18,76 +18,127 @@
  **************************************************************************/
 
 #include "imageprovider.h"
-#include <jobs/mediathumbnailjob.h>
+#include "mediacache.h"
+#include "imagebudget.h"
 
-#include <QtCore/QMutex>
-#include <QtCore/QMutexLocker>
-#include <QtCore/QWaitCondition>
+#include <QtGui/QGuiApplication>
 
 #include <QtCore/QDebug>
 
-ImageProvider::ImageProvider(QMatrixClient::Connection* connection)
-    : QQuickImageProvider(QQmlImageProviderBase::Pixmap, QQmlImageProviderBase::ForceAsynchronousImageLoading)
-    , m_connection(connection)
+ThumbnailResponse::ThumbnailResponse(ImageProvider* provider, QString id, QSize requestedSize)
+    : m_provider(provider)
+    , m_id(id)
+    , m_requestedSize(requestedSize)
 {
-    qRegisterMetaType<QPixmap*>();
-    qRegisterMetaType<QWaitCondition*>();
 }
 
-QPixmap ImageProvider::requestPixmap(const QString& id, QSize* size, const QSize& requestedSize)
+QQuickTextureFactory* ThumbnailResponse::textureFactory() const
 {
-    QMutexLocker locker(&m_mutex);
-    qDebug() << "ImageProvider::requestPixmap:" << id;
-
-    QWaitCondition* condition = new QWaitCondition();
-    QPixmap result;
-    QMetaObject::invokeMethod(this, "doRequest", Qt::QueuedConnection,
-                              Q_ARG(QString, id), Q_ARG(QSize, requestedSize),
-                              Q_ARG(QPixmap*, &result), Q_ARG(QWaitCondition*, condition));
-    condition->wait(&m_mutex);
-    delete condition;
-
-    if( size != nullptr )
-    {
-        *size = result.size();
-    }
-    return result;
+    return m_image.isNull() ? nullptr : ImageBudget::textureFactory(m_image);
 }
 
-void ImageProvider::setConnection(QMatrixClient::Connection* connection)
+QString ThumbnailResponse::errorString() const
+{
+    return m_error;
+}
+
+void ThumbnailResponse::cancel()
+{
+    // Called on the loader thread; the provider finishes the response
+    QMetaObject::invokeMethod(m_provider, "cancelRequest", Qt::QueuedConnection,
+                              Q_ARG(ThumbnailResponse*, this));
+}
+
+QString ThumbnailResponse::id() const
 {
-    QMutexLocker locker(&m_mutex);
+    return m_id;
+}
+
+QSize ThumbnailResponse::requestedSize() const
+{
+    return m_requestedSize;
+}
 
-    m_connection = connection;
+void ThumbnailResponse::finish(const QImage& image, const QString& error)
+{
+    m_image = image;
+    m_error = error;
+    // The engine may delete the response once this is emitted
+    emit finished();
+}
+
+ImageProvider::ImageProvider(QMatrixClient::Connection* connection)
+    : m_connection(static_cast<QuaternionConnection*>(connection))
+{
+    qRegisterMetaType<ThumbnailResponse*>();
 }
 
-void ImageProvider::doRequest(QString id, QSize requestedSize, QPixmap* pixmap, QWaitCondition* condition)
+QQuickImageResponse* ImageProvider::requestImageResponse(const QString& id, const QSize& requestedSize)
 {
-    QMutexLocker locker(&m_mutex);
+    ThumbnailResponse* response = new ThumbnailResponse(this, id, requestedSize);
+    QMetaObject::invokeMethod(this, "enqueue", Qt::QueuedConnection,
+                              Q_ARG(ThumbnailResponse*, response));
+    return response;
+}
 
-    int width = requestedSize.width() > 0 ? requestedSize.width() : 100;
-    int height = requestedSize.height() > 0 ? requestedSize.height() : 100;
+void ImageProvider::setConnection(QMatrixClient::Connection* connection)
+{
+    // The requests belong to the old connection's cache
+    for( auto it = m_requests.begin(); it != m_requests.end(); ++it )
+    {
+        it.value()->cancel();
+        it.key()->finish(QImage(), "Cancelled");
+    }
+    m_requests.clear();
+    m_connection = static_cast<QuaternionConnection*>(connection);
+}
 
+void ImageProvider::enqueue(ThumbnailResponse* response)
+{
     if( !m_connection )
     {
-        qDebug() << "ImageProvider::requestPixmap: no connection!";
-        *pixmap = QPixmap();
-        condition->wakeAll();
+        qDebug() << "ImageProvider::enqueue: no connection!";
+        response->finish(QImage(), "No connection");
+        return;
+    }
+
+    MediaCache* cache = m_connection->mediaCache();
+    const int bucket = ImageBudget::bucketFor(response->id(), response->requestedSize(),
+                                              qGuiApp->devicePixelRatio());
+    const QImage image = cache->cachedImage(response->id(), bucket);
+    if( !image.isNull() )
+    {
+        finish(response, image);
+        return;
     }
 
-    QMatrixClient::MediaThumbnailJob* job = m_connection->getThumbnail(QUrl(id), width, height);
-    QObject::connect( job, &QMatrixClient::MediaThumbnailJob::success, this, &ImageProvider::gotImage );
-    ImageProviderData data = { pixmap, condition, requestedSize };
-    m_callmap.insert(job, data);
+    MediaRequest* request = cache->request(response->id(), bucket);
+    m_requests.insert(response, request);
+    connect( request, &MediaRequest::finished, this, [this, response](QImage image) {
+        m_requests.remove(response);
+        finish(response, image);
+    });
 }
 
-void ImageProvider::gotImage(QMatrixClient::BaseJob* job)
+void ImageProvider::cancelRequest(ThumbnailResponse* response)
 {
-    QMutexLocker locker(&m_mutex);
-    qDebug() << "gotImage";
+    // Otherwise it has finished already
+    if( MediaRequest* request = m_requests.take(response) )
+    {
+        request->cancel();
+        response->finish(QImage(), "Cancelled");
+    }
+}
+
+void ImageProvider::finish(ThumbnailResponse* response, QImage image)
+{
+    if( image.isNull() )
+    {
+        response->finish(image, "Failed to load " + response->id());
+        return;
+    }
 
-    auto mediaJob = static_cast<QMatrixClient::MediaThumbnailJob*>(job);
-    ImageProviderData data = m_callmap.take(mediaJob);
-    *data.pixmap = mediaJob->thumbnail().scaled(data.requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-    data.condition->wakeAll();
+    // Handed over as cached, so that it's charged to the budget once; the
+    // scene graph scales the texture down to the item's size
+    response->finish(image);
 }
@@ -21,42 +21,71 @@
 #define IMAGEPROVIDER_H
 
 #include <QtQuick/QQuickImageProvider>
-#include <QtCore/QThread>
-#include <QtCore/QMutex>
-#include <QtCore/QWaitCondition>
+#include <QtCore/QHash>
 
-#include <lib/jobs/basejob.h>
 #include "quaternionconnection.h"
 
-struct ImageProviderData
+class ImageProvider;
+class MediaRequest;
+
+/**
+ * One image requested by QML. Created on a QML image loader thread and
+ * filled in by the provider on the main thread;
+ * finished() is emitted exactly once, also when the request fails or is
+ * cancelled.
+ */
+class ThumbnailResponse: public QQuickImageResponse
 {
-    QPixmap* pixmap;
-    QWaitCondition* condition;
-    QSize requestedSize;
+        Q_OBJECT
+    public:
+        ThumbnailResponse(ImageProvider* provider, QString id, QSize requestedSize);
+
+        QQuickTextureFactory* textureFactory() const override;
+        QString errorString() const override;
+        void cancel() override;
+
+        QString id() const;
+        QSize requestedSize() const;
+        /** Stores the result and emits finished(); call it only once */
+        void finish(const QImage& image, const QString& error = QString());
+
+    private:
+        ImageProvider* m_provider;
+        QString m_id;
+        QSize m_requestedSize;
+        QImage m_image;
+        QString m_error;
 };
 
-class ImageProvider: public QObject, public QQuickImageProvider
+/**
+ * Serves "image://mtx/<server>/<media id>" to QML from the connection's
+ * MediaCache. Requests never block the loader threads: they are handed
+ * over to the main thread, where the cache runs them; decoding happens
+ * on the cache's thread pool. Images are handed to QML as the cache
+ * holds them, at their bucket's size, so they count towards the
+ * ImageBudget once; they come at a lower resolution when it runs out.
+ */
+class ImageProvider: public QObject, public QQuickAsyncImageProvider
 {
         Q_OBJECT
     public:
         ImageProvider(QMatrixClient::Connection* connection);
 
-        QPixmap requestPixmap(const QString& id, QSize* size, const QSize& requestedSize);
+        QQuickImageResponse* requestImageResponse(const QString& id, const QSize& requestedSize) override;
 
         void setConnection(QMatrixClient::Connection* connection);
 
-    private slots:
-        void gotImage(QMatrixClient::BaseJob* job);
-
     private:
-        Q_INVOKABLE void doRequest(QString id, QSize requestedSize, QPixmap* pixmap, QWaitCondition* condition);
+        friend class ThumbnailResponse;
+        Q_INVOKABLE void enqueue(ThumbnailResponse* response);
+        Q_INVOKABLE void cancelRequest(ThumbnailResponse* response);
+        void finish(ThumbnailResponse* response, QImage image);
 
-        QMatrixClient::Connection* m_connection;
-        QHash<QMatrixClient::MediaThumbnailJob*, ImageProviderData> m_callmap;
-        QMutex m_mutex;
+        QuaternionConnection* m_connection;
+        /** Responses waiting for the cache */
+        QHash<ThumbnailResponse*, MediaRequest*> m_requests;
 };
 
-Q_DECLARE_METATYPE(QPixmap*)
-Q_DECLARE_METATYPE(QWaitCondition*)
+Q_DECLARE_METATYPE(ThumbnailResponse*)
 
 #endif // IMAGEPROVIDER_H
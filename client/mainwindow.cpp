@@ -30,6 +30,9 @@
 #include "quaternionconnection.h"
 #include "roomlistdock.h"
 #include "userlistdock.h"
+#include "searchdock.h"
+#include "directorydock.h"
+#include "roomswitcher.h"
 #include "chatroomwidget.h"
 #include "logindialog.h"
 #include "systemtray.h"
@@ -42,10 +45,19 @@ MainWindow::MainWindow()
     addDockWidget(Qt::LeftDockWidgetArea, roomListDock);
     userListDock = new UserListDock(this);
     addDockWidget(Qt::RightDockWidgetArea, userListDock);
+    searchDock = new SearchDock(this);
+    addDockWidget(Qt::RightDockWidgetArea, searchDock);
+    directoryDock = new DirectoryDock(this);
+    addDockWidget(Qt::RightDockWidgetArea, directoryDock);
+    directoryDock->hide();
     chatRoomWidget = new ChatRoomWidget(this);
     setCentralWidget(chatRoomWidget);
     connect( roomListDock, &RoomListDock::roomSelected, chatRoomWidget, &ChatRoomWidget::setRoom );
     connect( roomListDock, &RoomListDock::roomSelected, userListDock, &UserListDock::setRoom );
+    connect( roomListDock, &RoomListDock::roomSelected, searchDock, &SearchDock::setRoom );
+    connect( searchDock, &SearchDock::resultActivated, this, &MainWindow::showSearchResult );
+    roomSwitcher = new RoomSwitcher(this);
+    connect( roomSwitcher, &RoomSwitcher::roomSelected, roomListDock, &RoomListDock::selectRoom );
     systemTray = new SystemTray(this);
     systemTray->show();
     QTimer::singleShot(0, this, SLOT(initialize()));
@@ -68,6 +80,10 @@ void MainWindow::initialize()
     roomMenu = new QMenu(tr("&Room"));
     menuBar->addMenu(roomMenu);
 
+    highlightKeywordsAction = new QAction(tr("&Highlight Keywords..."), this);
+    connect( highlightKeywordsAction, &QAction::triggered, this, &MainWindow::showHighlightKeywordsDialog );
+    connectionMenu->addAction(highlightKeywordsAction);
+
     quitAction = new QAction(tr("&Quit"), this);
     quitAction->setShortcut(QKeySequence(QKeySequence::Quit));
     connect( quitAction, &QAction::triggered, qApp, &QApplication::quit );
@@ -77,6 +93,23 @@ void MainWindow::initialize()
     connect( joinRoomAction, &QAction::triggered, this, &MainWindow::showJoinRoomDialog );
     roomMenu->addAction(joinRoomAction);
 
+    QAction* directoryAction = directoryDock->toggleViewAction();
+    directoryAction->setText(tr("&Browse Directory"));
+    roomMenu->addAction(directoryAction);
+
+    switchRoomAction = new QAction(tr("&Switch Room..."), this);
+    switchRoomAction->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_K));
+    connect( switchRoomAction, &QAction::triggered, roomSwitcher, &RoomSwitcher::show );
+    roomMenu->addAction(switchRoomAction);
+
+    jumpToUnreadAction = new QAction(tr("Jump to &Unread"), this);
+    connect( jumpToUnreadAction, &QAction::triggered, chatRoomWidget, &ChatRoomWidget::jumpToReadMarker );
+    roomMenu->addAction(jumpToUnreadAction);
+
+    jumpToDateAction = new QAction(tr("Jump to &Date..."), this);
+    connect( jumpToDateAction, &QAction::triggered, this, &MainWindow::showJumpToDateDialog );
+    roomMenu->addAction(jumpToDateAction);
+
     setMenuBar(menuBar);
 
     LoginDialog dialog(this);
@@ -84,6 +117,8 @@ void MainWindow::initialize()
         chatRoomWidget->setConnection(connection);
         userListDock->setConnection(connection);
         roomListDock->setConnection(connection);
+        roomSwitcher->setConnection(connection);
+        directoryDock->setConnection(connection);
         systemTray->setConnection(connection);
         connect( connection, &QMatrixClient::Connection::connectionError, this, &MainWindow::connectionError );
         connect( connection, &QMatrixClient::Connection::syncDone, this, &MainWindow::gotEvents );
@@ -93,14 +128,17 @@ void MainWindow::initialize()
     if( dialog.exec() )
     {
         connection = dialog.connection();
-        connection->sync();
+        connection->loadState();
+        // The search index only exists once the state starts loading
+        searchDock->setConnection(connection);
+        connection->backgroundSync();
     }
 }
 
 void MainWindow::getNewEvents()
 {
     //qDebug() << "getNewEvents";
-    connection->sync(30*1000);
+    connection->backgroundSync(30*1000);
 }
 
 void MainWindow::gotEvents()
@@ -119,7 +157,10 @@ void MainWindow::connectionError(QString error)
 void MainWindow::closeEvent(QCloseEvent* event)
 {
     if (connection)
+    {
         connection->disconnect( this ); // Disconnects all signals, not the connection itself
+        connection->saveState();
+    }
 
     event->accept();
 }
@@ -135,4 +176,39 @@ void MainWindow::showJoinRoomDialog()
     }
 }
 
+void MainWindow::showJumpToDateDialog()
+{
+    bool ok;
+    QString text = QInputDialog::getText(this, tr("Jump to Date"), tr("Enter a date (YYYY-MM-DD)"),
+                                         QLineEdit::Normal, QDate::currentDate().toString(Qt::ISODate), &ok);
+    const QDate date = QDate::fromString(text.trimmed(), Qt::ISODate);
+    if( ok && date.isValid() )
+        chatRoomWidget->jumpToDate(date);
+}
 
+void MainWindow::showHighlightKeywordsDialog()
+{
+    if( !connection )
+        return;
+
+    bool ok;
+    QString keywords = QInputDialog::getText(this, tr("Highlight Keywords"),
+        tr("Messages containing any of these comma-separated words are highlighted"),
+        QLineEdit::Normal, connection->highlightKeywords().join(", "), &ok);
+    if( ok )
+    {
+        QStringList keywordList;
+        for( const QString& keyword: keywords.split(',', QString::SkipEmptyParts) )
+            if( !keyword.trimmed().isEmpty() )
+                keywordList << keyword.trimmed();
+        connection->setHighlightKeywords(keywordList);
+    }
+}
+
+void MainWindow::showSearchResult(QMatrixClient::Room* room, QString eventId, QDateTime timestamp)
+{
+    chatRoomWidget->setRoom(room);
+    userListDock->setRoom(room);
+    searchDock->setRoom(room);
+    chatRoomWidget->scrollToEvent(eventId, timestamp);
+}
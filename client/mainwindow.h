@@ -27,6 +27,9 @@
 
 class RoomListDock;
 class UserListDock;
+class SearchDock;
+class DirectoryDock;
+class RoomSwitcher;
 class ChatRoomWidget;
 class QuaternionConnection;
 class SystemTray;
@@ -57,10 +60,16 @@ class MainWindow: public QMainWindow
 
     private slots:
         void showJoinRoomDialog();
+        void showJumpToDateDialog();
+        void showHighlightKeywordsDialog();
+        void showSearchResult(QMatrixClient::Room* room, QString eventId, QDateTime timestamp);
 
     private:
         RoomListDock* roomListDock;
         UserListDock* userListDock;
+        SearchDock* searchDock;
+        DirectoryDock* directoryDock;
+        RoomSwitcher* roomSwitcher;
         ChatRoomWidget* chatRoomWidget;
         QuaternionConnection* connection;
 
@@ -70,6 +79,10 @@ class MainWindow: public QMainWindow
 
         QAction* quitAction;
         QAction* joinRoomAction;
+        QAction* switchRoomAction;
+        QAction* jumpToUnreadAction;
+        QAction* jumpToDateAction;
+        QAction* highlightKeywordsAction;
 
         SystemTray* systemTray;
 };
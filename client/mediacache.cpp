@@ -0,0 +1,462 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "mediacache.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QBuffer>
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSettings>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QtMath>
+#include <QtCore/QUrlQuery>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtCore/QFutureWatcher>
+#include <QtGui/QGuiApplication>
+#include <QtGui/QImageReader>
+#include <QtNetwork/QNetworkReply>
+
+#include <algorithm>
+#include <climits>
+
+#include "quaternionconnection.h"
+#include "imagebudget.h"
+
+namespace
+{
+    // The share of the ImageBudget decoded images may keep in memory
+    const int MemoryShare = 2;
+    // The disk quota unless set with the "media/disk_quota_mb" setting
+    const int DefaultDiskQuotaMb = 512;
+    // Eviction goes a bit below the quota so it doesn't run on every store
+    const double EvictionTarget = 0.9;
+    // Smallest and largest thumbnail buckets, in device pixels
+    const int MinBucket = 64;
+    const int MaxBucket = 2048;
+    const int MaxParallelDownloads = 6;
+    // A download taking longer than this is aborted
+    const int DownloadTimeout = 30 * 1000;
+
+    const QString IndexFileName { "index" };
+    const quint32 IndexMagic = 0x51434d49; // "QCMI"
+    const quint32 IndexVersion = 1;
+    const char* const KeyProperty = "mediaCacheKey";
+
+    /**
+     * Decodes the image to fit in the bucket. Decoders that can scale
+     * while decoding (JPEG can) go down to about twice the bucket,
+     * skipping most of the work; a smooth pass takes it the rest of the
+     * way. The result is in a format the scene graph uploads as is.
+     * Animated images only yield their first frame.
+     */
+    QImage readImage(QImageReader& reader, int bucket)
+    {
+        reader.setAutoTransform(true);
+        if( bucket > 0 && reader.supportsOption(QImageIOHandler::ScaledSize) )
+        {
+            const QSize size = reader.size();
+            if( size.isValid() && qMax(size.width(), size.height()) > 2 * bucket )
+                reader.setScaledSize(size.scaled(2 * bucket, 2 * bucket, Qt::KeepAspectRatio));
+        }
+        QImage image = reader.read();
+        if( image.isNull() )
+            return image;
+        if( bucket > 0 && (image.width() > bucket || image.height() > bucket) )
+            image = image.scaled(bucket, bucket, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        return image.convertToFormat(image.hasAlphaChannel() ?
+            QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+    }
+
+    QImage decodeData(QByteArray data, int bucket)
+    {
+        QBuffer buffer { &data };
+        buffer.open(QBuffer::ReadOnly);
+        QImageReader reader { &buffer };
+        return readImage(reader, bucket);
+    }
+
+    QImage decodeFile(const QString& path, int bucket)
+    {
+        QImageReader reader { path };
+        return readImage(reader, bucket);
+    }
+}
+
+MediaRequest::MediaRequest(MediaCache* cache, QString key)
+    : QObject(cache)
+    , m_cache(cache)
+    , m_key(key)
+{
+}
+
+void MediaRequest::cancel()
+{
+    m_cache->cancel(this);
+}
+
+MediaCache::MediaCache(QuaternionConnection* connection, QString directory, QObject* parent)
+    : QObject(parent)
+    , m_connection(connection)
+    , m_directory(directory)
+    , m_images(int(qMin<qint64>(ImageBudget::limit() / MemoryShare, INT_MAX)))
+    , m_diskUsage(0)
+    , m_indexDirty(false)
+    , m_running(0)
+{
+    m_diskQuota = qint64(QSettings().value("media/disk_quota_mb", DefaultDiskQuotaMb).toInt())
+                  * 1024 * 1024;
+    QDir().mkpath(m_directory);
+    loadIndex();
+    // Leave a core to the sync parser and the rest of the application
+    m_decodePool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+}
+
+MediaCache::~MediaCache()
+{
+    // Pending decodes report to this object
+    m_decodePool.clear();
+    m_decodePool.waitForDone();
+    saveIndex();
+}
+
+int MediaCache::sizeBucket(const QSize& size, qreal devicePixelRatio)
+{
+    if( size.width() <= 0 && size.height() <= 0 )
+        return 0;
+    const int pixels = qCeil(qMax(size.width(), size.height()) * devicePixelRatio);
+    int bucket = MinBucket;
+    while( bucket < pixels && bucket < MaxBucket )
+        bucket *= 2;
+    return bucket;
+}
+
+QString MediaCache::key(const QString& mediaId, int bucket)
+{
+    return mediaId + '@' + QString::number(bucket);
+}
+
+QString MediaCache::fileName(const QString& key) const
+{
+    return QString::fromLatin1(
+        QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+QImage MediaCache::cachedImage(const QString& mediaId, int bucket)
+{
+    if( BudgetedImage* image = m_images.object(key(mediaId, bucket)) )
+        return image->image();
+    return QImage();
+}
+
+QString MediaCache::localFile(const QString& mediaId, int bucket)
+{
+    const QString name = fileName(key(mediaId, bucket));
+    if( !m_files.contains(name) )
+        return QString();
+    touch(name);
+    return m_directory + '/' + name;
+}
+
+MediaRequest* MediaCache::request(const QString& mediaId, int bucket)
+{
+    const QString k = key(mediaId, bucket);
+    MediaRequest* request = new MediaRequest(this, k);
+
+    const QImage image = cachedImage(mediaId, bucket);
+    if( !image.isNull() )
+    {
+        // Requests always finish asynchronously, even on a hit
+        QTimer::singleShot(0, request, [request, image] {
+            emit request->finished(image);
+            request->deleteLater();
+        });
+        return request;
+    }
+
+    auto it = m_downloads.find(k);
+    if( it == m_downloads.end() )
+    {
+        it = m_downloads.insert(k, { mediaId, bucket, nullptr, false, false, {} });
+        const QString name = fileName(k);
+        if( m_files.contains(name) )
+        {
+            touch(name);
+            it->fromDisk = true;
+            const QString path = m_directory + '/' + name;
+            startDecoding(k, [path, bucket] { return decodeFile(path, bucket); });
+        }
+        else
+        {
+            m_queue.append(k);
+            startDownloads();
+        }
+    }
+    it->waiters.append(request);
+    return request;
+}
+
+void MediaCache::startDownloads()
+{
+    while( m_running < MaxParallelDownloads && !m_queue.isEmpty() )
+    {
+        const QString k = m_queue.takeFirst();
+        Download& download = m_downloads[k];
+
+        QUrlQuery query;
+        QString path;
+        if( download.bucket == 0 )
+            path = "/download/" + download.mediaId;
+        else
+        {
+            path = "/thumbnail/" + download.mediaId;
+            query.addQueryItem("width", QString::number(download.bucket));
+            query.addQueryItem("height", QString::number(download.bucket));
+            query.addQueryItem("method", "scale");
+        }
+        QNetworkReply* reply = m_connection->mediaGet(path, query);
+        reply->setProperty(KeyProperty, k);
+        connect( reply, &QNetworkReply::finished, this, &MediaCache::replyFinished );
+        QTimer::singleShot(DownloadTimeout, reply, [reply] { reply->abort(); });
+        download.reply = reply;
+        ++m_running;
+    }
+}
+
+void MediaCache::replyFinished()
+{
+    QNetworkReply* reply = static_cast<QNetworkReply*>(sender());
+    reply->deleteLater();
+    --m_running;
+    QTimer::singleShot(0, this, [this] { startDownloads(); });
+    const QString k = reply->property(KeyProperty).toString();
+    auto it = m_downloads.find(k);
+    it->reply = nullptr;
+
+    if( reply->error() != QNetworkReply::NoError )
+    {
+        if( reply->error() != QNetworkReply::OperationCanceledError || !it->waiters.isEmpty() )
+            qDebug() << "Failed to download" << it->mediaId << ":" << reply->errorString();
+        const Download download = m_downloads.take(k);
+        for( MediaRequest* request: download.waiters )
+        {
+            emit request->finished(QImage());
+            request->deleteLater();
+        }
+        return;
+    }
+
+    // The file is stored as is; it gets dropped if it can't be decoded
+    const QByteArray data = reply->readAll();
+    store(k, data);
+    const int bucket = it->bucket;
+    startDecoding(k, [data, bucket] { return decodeData(data, bucket); });
+}
+
+void MediaCache::startDecoding(const QString& key, std::function<QImage()> decoder)
+{
+    m_downloads[key].decoding = true;
+    auto watcher = new QFutureWatcher<QImage>(this);
+    watcher->setProperty(KeyProperty, key);
+    connect( watcher, &QFutureWatcher<QImage>::finished, this, &MediaCache::decodeFinished );
+    // Buckets are in device pixels; with the ratio set here, views can
+    // take the cached image as it is, without a copy of their own
+    const qreal dpr = qGuiApp->devicePixelRatio();
+    watcher->setFuture(QtConcurrent::run(&m_decodePool, [decoder, dpr] {
+        QImage image = decoder();
+        image.setDevicePixelRatio(dpr);
+        return image;
+    }));
+}
+
+void MediaCache::decodeFinished()
+{
+    auto watcher = static_cast<QFutureWatcher<QImage>*>(sender());
+    watcher->deleteLater();
+    const QString k = watcher->property(KeyProperty).toString();
+    const QImage image = watcher->result();
+    auto it = m_downloads.find(k);
+    it->decoding = false;
+
+    if( image.isNull() )
+    {
+        const QString name = fileName(k);
+        if( m_files.contains(name) )
+        {
+            QFile::remove(m_directory + '/' + name);
+            m_diskUsage -= m_files.take(name).size;
+            m_indexDirty = true;
+        }
+        if( it->fromDisk && !it->waiters.isEmpty() )
+        {
+            // Gone or damaged; download it again
+            it->fromDisk = false;
+            m_queue.append(k);
+            startDownloads();
+            return;
+        }
+        qDebug() << "Couldn't decode" << it->mediaId;
+    }
+    else
+        m_images.insert(k, new BudgetedImage(image), image.byteCount());
+
+    const Download download = m_downloads.take(k);
+    for( MediaRequest* request: download.waiters )
+    {
+        emit request->finished(image);
+        request->deleteLater();
+    }
+}
+
+void MediaCache::cancel(MediaRequest* request)
+{
+    // Nothing is emitted for a cancelled request any more
+    request->blockSignals(true);
+    request->deleteLater();
+
+    auto it = m_downloads.find(request->m_key);
+    if( it == m_downloads.end() || !it->waiters.removeOne(request) || !it->waiters.isEmpty() )
+        return;
+    // Nobody waits for the download any more. A decode can't be
+    // stopped; its result just goes to the memory cache.
+    if( it->reply )
+        it->reply->abort(); // replyFinished() cleans up
+    else if( !it->decoding )
+    {
+        m_queue.removeOne(it.key());
+        m_downloads.erase(it);
+    }
+}
+
+void MediaCache::store(const QString& key, const QByteArray& data)
+{
+    const QString name = fileName(key);
+    QSaveFile file { m_directory + '/' + name };
+    if( !file.open(QFile::WriteOnly) || file.write(data) != data.size() || !file.commit() )
+    {
+        qWarning() << "Couldn't save media to" << file.fileName() << ":" << file.errorString();
+        return;
+    }
+    if( m_files.contains(name) )
+        m_diskUsage -= m_files.value(name).size;
+    m_files.insert(name, { data.size(), QDateTime::currentMSecsSinceEpoch() });
+    m_diskUsage += data.size();
+    m_indexDirty = true;
+    evict();
+}
+
+void MediaCache::touch(const QString& fileName)
+{
+    m_files[fileName].lastUsed = QDateTime::currentMSecsSinceEpoch();
+    m_indexDirty = true;
+}
+
+void MediaCache::evict()
+{
+    if( m_diskUsage <= m_diskQuota )
+        return;
+
+    QList<QString> names = m_files.keys();
+    std::sort(names.begin(), names.end(), [this](const QString& a, const QString& b) {
+        return m_files.value(a).lastUsed < m_files.value(b).lastUsed;
+    });
+    for( const QString& name: names )
+    {
+        if( m_diskUsage <= qint64(m_diskQuota * EvictionTarget) )
+            break;
+        QFile::remove(m_directory + '/' + name);
+        m_diskUsage -= m_files.take(name).size;
+    }
+    m_indexDirty = true;
+}
+
+void MediaCache::loadIndex()
+{
+    QFile file { m_directory + '/' + IndexFileName };
+    if( file.open(QFile::ReadOnly) )
+    {
+        QDataStream in { &file };
+        quint32 magic, version;
+        in >> magic >> version;
+        if( magic == IndexMagic && version == IndexVersion )
+        {
+            in.setVersion(QDataStream::Qt_5_2);
+            quint32 count;
+            in >> count;
+            for( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i )
+            {
+                QString name;
+                DiskEntry entry;
+                in >> name >> entry.size >> entry.lastUsed;
+                m_files.insert(name, entry);
+                m_diskUsage += entry.size;
+            }
+            if( in.status() == QDataStream::Ok )
+                return;
+        }
+        qWarning() << "Ignoring the damaged media cache index";
+        m_files.clear();
+        m_diskUsage = 0;
+    }
+
+    // No index (e.g. after a crash): take the files as they are
+    QDirIterator it(m_directory, QDir::Files);
+    while( it.hasNext() )
+    {
+        it.next();
+        if( it.fileName() == IndexFileName )
+            continue;
+        const QFileInfo info = it.fileInfo();
+        m_files.insert(info.fileName(), { info.size(), info.lastModified().toMSecsSinceEpoch() });
+        m_diskUsage += info.size();
+    }
+    m_indexDirty = true;
+}
+
+void MediaCache::saveIndex()
+{
+    if( !m_indexDirty )
+        return;
+
+    QSaveFile file { m_directory + '/' + IndexFileName };
+    if( !file.open(QFile::WriteOnly) )
+    {
+        qWarning() << "Couldn't open" << file.fileName() << "to save the media cache index:" << file.errorString();
+        return;
+    }
+    QDataStream out { &file };
+    out << IndexMagic << IndexVersion;
+    out.setVersion(QDataStream::Qt_5_2);
+    out << quint32(m_files.size());
+    for( auto it = m_files.begin(); it != m_files.end(); ++it )
+        out << it.key() << it.value().size << it.value().lastUsed;
+    if( !file.commit() )
+    {
+        qWarning() << "Couldn't save the media cache index:" << file.errorString();
+        return;
+    }
+    m_indexDirty = false;
+}
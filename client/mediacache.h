@@ -0,0 +1,152 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef MEDIACACHE_H
+#define MEDIACACHE_H
+
+#include <QtCore/QCache>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QThreadPool>
+#include <QtGui/QImage>
+
+#include <functional>
+
+#include "imagebudget.h"
+
+class QuaternionConnection;
+class QNetworkReply;
+class MediaCache;
+
+/**
+ * A pending MediaCache::request(). Emits finished() once, with a null
+ * image on failure, and is deleted by the cache afterwards; after
+ * cancel() it emits nothing and is deleted as well.
+ */
+class MediaRequest: public QObject
+{
+        Q_OBJECT
+    public:
+        void cancel();
+
+    signals:
+        void finished(QImage image);
+
+    private:
+        friend class MediaCache;
+        MediaRequest(MediaCache* cache, QString key);
+
+        MediaCache* m_cache;
+        QString m_key;
+};
+
+/**
+ * Images from the media repository, by media id ("<server>/<id>") and
+ * size. Sizes are rounded up to a few buckets (in device pixels) so that
+ * slightly different requests share an entry; bucket 0 is the full
+ * media. Decoded images are kept in memory up to a share of the
+ * ImageBudget, and are charged to it while they're there;
+ * downloaded files are kept on disk up to a quota, the least recently
+ * used ones going first. Requests for an entry that is being downloaded
+ * wait for the same download.
+ *
+ * Files are read, decoded and scaled on a thread pool of the cache's
+ * own; the main thread only moves finished images around.
+ */
+class MediaCache: public QObject
+{
+        Q_OBJECT
+    public:
+        MediaCache(QuaternionConnection* connection, QString directory,
+                   QObject* parent = nullptr);
+        virtual ~MediaCache();
+
+        /**
+         * The bucket for an image shown at the given size on a screen
+         * with the given device pixel ratio; 0 if neither dimension is set.
+         */
+        static int sizeBucket(const QSize& size, qreal devicePixelRatio);
+
+        /** Returns the image if it's in memory, or a null image */
+        QImage cachedImage(const QString& mediaId, int bucket);
+        /**
+         * Loads the image from disk or the server. The request is owned
+         * by the cache; see MediaRequest.
+         */
+        MediaRequest* request(const QString& mediaId, int bucket);
+        /** Path of the downloaded file, or an empty string if there's none */
+        QString localFile(const QString& mediaId, int bucket);
+
+    public slots:
+        /** Saves the usage order of the files on disk */
+        void saveIndex();
+
+    private slots:
+        void replyFinished();
+        void decodeFinished();
+
+    private:
+        friend class MediaRequest;
+
+        struct DiskEntry
+        {
+            qint64 size;
+            qint64 lastUsed;
+        };
+        struct Download
+        {
+            QString mediaId;
+            int bucket;
+            QNetworkReply* reply;
+            /** Whether the image is being decoded on the thread pool */
+            bool decoding;
+            /** Whether it's decoded from the file on disk */
+            bool fromDisk;
+            QList<MediaRequest*> waiters;
+        };
+
+        static QString key(const QString& mediaId, int bucket);
+        QString fileName(const QString& key) const;
+        void loadIndex();
+        void touch(const QString& fileName);
+        void store(const QString& key, const QByteArray& data);
+        void evict();
+        void startDownloads();
+        void startDecoding(const QString& key, std::function<QImage()> decoder);
+        void cancel(MediaRequest* request);
+
+        QuaternionConnection* m_connection;
+        QString m_directory;
+        /** Decoded images by key; the cost is their size in bytes */
+        QCache<QString, BudgetedImage> m_images;
+        /** Files on disk by name */
+        QHash<QString, DiskEntry> m_files;
+        qint64 m_diskUsage;
+        qint64 m_diskQuota;
+        bool m_indexDirty;
+        /** Downloads by key, running or waiting for a free slot */
+        QHash<QString, Download> m_downloads;
+        /** Keys of downloads waiting for a slot, oldest first */
+        QList<QString> m_queue;
+        int m_running;
+        QThreadPool m_decodePool;
+};
+
+#endif // MEDIACACHE_H
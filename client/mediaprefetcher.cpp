@@ -0,0 +1,163 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "mediaprefetcher.h"
+
+#include <QtCore/QPair>
+#include <QtCore/QSet>
+#include <QtCore/QSettings>
+#include <QtCore/QUrl>
+#include <QtGui/QGuiApplication>
+
+#include "quaternionconnection.h"
+#include "mediacache.h"
+#include "imagebudget.h"
+#include "models/messageeventmodel.h"
+
+namespace
+{
+    // Rows above and below the viewport, unless set otherwise
+    const int DefaultPrefetchRows = 20;
+    const QString ImageScheme { "image://mtx/" };
+}
+
+MediaPrefetcher::MediaPrefetcher(QObject* parent)
+    : QObject(parent)
+    , m_model(nullptr)
+    , m_connection(nullptr)
+    , m_firstRow(-1)
+    , m_lastRow(-1)
+{
+    m_distance = qMax(0, QSettings().value("media/prefetch_rows", DefaultPrefetchRows).toInt());
+}
+
+void MediaPrefetcher::setConnection(QMatrixClient::Connection* connection)
+{
+    cancelAll();
+    m_connection = static_cast<QuaternionConnection*>(connection);
+}
+
+void MediaPrefetcher::setModel(MessageEventModel* model)
+{
+    if( model == m_model )
+        return;
+    cancelAll();
+    if( m_model )
+        m_model->disconnect( this );
+    m_model = model;
+    if( m_model )
+    {
+        connect( m_model, &MessageEventModel::modelReset, this, &MediaPrefetcher::cancelAll );
+        // Rows near the viewport may have come or gone at the same indices
+        connect( m_model, &MessageEventModel::rowsInserted,
+                 this, &MediaPrefetcher::invalidateViewport );
+        connect( m_model, &MessageEventModel::rowsRemoved,
+                 this, &MediaPrefetcher::invalidateViewport );
+    }
+}
+
+void MediaPrefetcher::updateViewport(int firstRow, int lastRow)
+{
+    if( !m_connection || !m_model || firstRow < 0 || lastRow < firstRow )
+        return;
+    // The view calls this on every scroll step; most don't change the rows
+    if( firstRow == m_firstRow && lastRow == m_lastRow )
+        return;
+    m_firstRow = firstRow;
+    m_lastRow = lastRow;
+
+    // Nearest rows first, as the cache serves requests in order
+    const int rowCount = m_model->rowCount(QModelIndex());
+    QList<QPair<QString, QSize>> wanted;
+    for( int offset = 1; offset <= m_distance; ++offset )
+    {
+        for( int row: { lastRow + offset, firstRow - offset } )
+        {
+            if( row < 0 || row >= rowCount )
+                continue;
+            const QString id = mediaId(row);
+            if( !id.isEmpty() )
+                wanted.append({ id, imageSize(row) });
+        }
+    }
+    // Visible rows stay in the window, so that loads started while they
+    // were ahead aren't cancelled when they scroll into view
+    for( int row = firstRow; row <= lastRow && row < rowCount; ++row )
+    {
+        const QString id = mediaId(row);
+        if( !id.isEmpty() )
+            wanted.append({ id, imageSize(row) });
+    }
+
+    QSet<QString> window;
+    for( const auto& image: wanted )
+        window.insert(image.first);
+    for( auto it = m_requests.begin(); it != m_requests.end(); )
+    {
+        if( window.contains(it.key()) )
+            ++it;
+        else
+        {
+            it.value()->cancel();
+            it = m_requests.erase(it);
+        }
+    }
+
+    MediaCache* cache = m_connection->mediaCache();
+    for( const auto& image: wanted )
+    {
+        // The same bucket as the delegate will ask the provider for
+        const QString id = image.first;
+        const int bucket =
+            ImageBudget::bucketFor(id, image.second, qGuiApp->devicePixelRatio());
+        if( m_requests.contains(id) || !cache->cachedImage(id, bucket).isNull() )
+            continue;
+        MediaRequest* request = cache->request(id, bucket);
+        m_requests.insert(id, request);
+        connect( request, &MediaRequest::finished, this, [this, id] { m_requests.remove(id); } );
+    }
+}
+
+void MediaPrefetcher::invalidateViewport()
+{
+    m_firstRow = -1;
+    m_lastRow = -1;
+}
+
+void MediaPrefetcher::cancelAll()
+{
+    invalidateViewport();
+    for( MediaRequest* request: m_requests )
+        request->cancel();
+    m_requests.clear();
+}
+
+QString MediaPrefetcher::mediaId(int row) const
+{
+    const QModelIndex index = m_model->index(row);
+    if( m_model->data(index, MessageEventModel::EventTypeRole).toString() != "image" )
+        return QString();
+    const QString url = m_model->data(index, MessageEventModel::ContentRole).toUrl().toString();
+    return url.startsWith(ImageScheme) ? url.mid(ImageScheme.size()) : QString();
+}
+
+QSize MediaPrefetcher::imageSize(int row) const
+{
+    return m_model->data(m_model->index(row), MessageEventModel::ImageSizeRole).toSize();
+}
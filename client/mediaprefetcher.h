@@ -0,0 +1,81 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef MEDIAPREFETCHER_H
+#define MEDIAPREFETCHER_H
+
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QSize>
+
+namespace QMatrixClient
+{
+    class Connection;
+}
+class QuaternionConnection;
+class MessageEventModel;
+class MediaRequest;
+
+/**
+ * Loads thumbnails of image events near the viewport before their
+ * delegates ask for them, so that they don't pop in while scrolling.
+ * The window reaches the "media/prefetch_rows" setting's number of rows
+ * above and below the visible ones; loads for rows that leave it are
+ * cancelled. Images end up in the connection's MediaCache, where the
+ * delegates find them.
+ */
+class MediaPrefetcher: public QObject
+{
+        Q_OBJECT
+    public:
+        MediaPrefetcher(QObject* parent = nullptr);
+
+        void setConnection(QMatrixClient::Connection* connection);
+        /** Switches to the model of the view now shown */
+        void setModel(MessageEventModel* model);
+
+        /**
+         * Called by the view whenever it scrolls or its content changes,
+         * with the first and last visible rows (-1 if unknown). Does
+         * nothing unless the rows or the model changed since the last call.
+         */
+        Q_INVOKABLE void updateViewport(int firstRow, int lastRow);
+
+    private slots:
+        void cancelAll();
+        /** Makes the next updateViewport() recompute the window */
+        void invalidateViewport();
+
+    private:
+        /** Returns the media id of the image in the row, if it is one */
+        QString mediaId(int row) const;
+        /** The size the view shows the image in the row at */
+        QSize imageSize(int row) const;
+
+        MessageEventModel* m_model;
+        QuaternionConnection* m_connection;
+        int m_distance;
+        /** The viewport the window was last computed for */
+        int m_firstRow;
+        int m_lastRow;
+        /** Running loads by media id */
+        QHash<QString, MediaRequest*> m_requests;
+};
+
+#endif // MEDIAPREFETCHER_H
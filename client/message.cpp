@@ -18,46 +18,76 @@
  **************************************************************************/
 
 #include "message.h"
+#include "messagepool.h"
+#include "highlightmatcher.h"
+#include "quaternionroom.h"
 
 #include "lib/events/event.h"
 #include "lib/events/roommessageevent.h"
-#include "lib/user.h"
 #include "lib/connection.h"
-#include "lib/room.h"
+
+namespace
+{
+    MessagePool& messagePool()
+    {
+        // Never destroyed: messages may outlive static destructors
+        static MessagePool* pool = new MessagePool(sizeof(Message));
+        return *pool;
+    }
+
+    int currentLocaleGeneration = 0;
+}
 
 Message::Message(QMatrixClient::Connection* connection,
                  QMatrixClient::Event* event,
-                 QMatrixClient::Room* room)
-    : m_connection(connection)
-    , m_event(event)
+                 QuaternionRoom* room)
+    : Message(event, room ? *room->highlightMatcher() : HighlightMatcher({ connection->userId() }),
+              connection->userId())
+{
+}
+
+Message::Message(QMatrixClient::Event* event,
+                 const HighlightMatcher& matcher, QString localUserId)
+    : m_event(event)
     , m_isHighlight(false)
     , m_isStatusMessage(true)
+    , m_gap(nullptr)
 {
     using namespace QMatrixClient;
     if( event->type() == EventType::RoomMessage )
     {
         m_isStatusMessage = false;
-        RoomMessageEvent* messageEvent = static_cast<RoomMessageEvent*>(event);
-        User* localUser = m_connection->user();
-        // Only highlight messages from other users
-        if (messageEvent->userId() != localUser->id())
-        {
-            if( messageEvent->body().contains(localUser->id()) )
-            {
-                m_isHighlight = true;
-            }
-            if (room)
-            {
-                QString ownDisplayname = room->roomMembername(localUser);
-                if (messageEvent->body().contains(ownDisplayname))
-                    m_isHighlight = true;
-            }
-        }
+        updateHighlight(matcher, localUserId);
     }
 }
 
+Message::Message(const QDateTime& timestamp)
+    : m_event(nullptr)
+    , m_isHighlight(false)
+    , m_isStatusMessage(true)
+    , m_gap(new Gap)
+{
+    m_gap->timestamp = timestamp;
+}
+
 Message::~Message()
 {
+    delete m_gap;
+}
+
+void* Message::operator new(size_t size)
+{
+    if( size != sizeof(Message) )
+        return ::operator new(size);
+    return messagePool().allocate();
+}
+
+void Message::operator delete(void* ptr, size_t size)
+{
+    if( size != sizeof(Message) )
+        ::operator delete(ptr);
+    else
+        messagePool().release(ptr);
 }
 
 QMatrixClient::Event* Message::messageEvent() const
@@ -65,9 +95,32 @@ QMatrixClient::Event* Message::messageEvent() const
     return m_event;
 }
 
+QString Message::eventId() const
+{
+    return m_event ? m_event->id() : QString();
+}
+
+QString Message::senderId() const
+{
+    using namespace QMatrixClient;
+    if( !m_event || m_event->type() != EventType::RoomMessage )
+        return QString();
+    return static_cast<RoomMessageEvent*>(m_event)->userId();
+}
+
 QDateTime Message::timestamp() const
 {
-    return m_event->timestamp();
+    return m_event ? m_event->timestamp() : m_gap->timestamp;
+}
+
+bool Message::isGap() const
+{
+    return m_gap != nullptr;
+}
+
+Message::Gap* Message::gap() const
+{
+    return m_gap;
 }
 
 bool Message::highlight() const
@@ -79,3 +132,34 @@ bool Message::isStatusMessage() const
 {
     return m_isStatusMessage;
 }
+
+bool Message::updateHighlight(const HighlightMatcher& matcher, const QString& localUserId)
+{
+    using namespace QMatrixClient;
+    if( !m_event || m_event->type() != EventType::RoomMessage )
+        return false;
+
+    RoomMessageEvent* messageEvent = static_cast<RoomMessageEvent*>(m_event);
+    // Only highlight messages from other users
+    const bool highlight = messageEvent->userId() != localUserId &&
+                           matcher.matches(messageEvent->body());
+    if( highlight == m_isHighlight )
+        return false;
+    m_isHighlight = highlight;
+    return true;
+}
+
+Message::RenderRecord& Message::renderRecord() const
+{
+    return m_renderRecord;
+}
+
+int Message::localeGeneration()
+{
+    return currentLocaleGeneration;
+}
+
+void Message::invalidateLocaleData()
+{
+    ++currentLocaleGeneration;
+}
@@ -21,33 +21,112 @@
 #define MESSAGE_H
 
 #include <QtCore/QDateTime>
+#include <QtCore/QSize>
+#include <QtCore/QVariant>
+
+#include <cstddef>
 
 namespace QMatrixClient
 {
     class Connection;
     class Event;
-    class Room;
 }
 
+class HighlightMatcher;
+class QuaternionRoom;
+
 class Message
 {
     public:
         Message(QMatrixClient::Connection* connection,
                 QMatrixClient::Event* event,
-                QMatrixClient::Room* room);
+                QuaternionRoom* room);
+        /**
+         * Doesn't touch the connection or the room, so unlike the
+         * constructor above it can be used outside of the GUI thread.
+         */
+        Message(QMatrixClient::Event* event,
+                const HighlightMatcher& matcher, QString localUserId);
+
+        /**
+         * Events the room knows to be missing from the local timeline,
+         * shown as a placeholder row. Pagination tokens are filled
+         * in as they become known; an empty token can be obtained from
+         * the event on that side of the gap.
+         */
+        struct Gap
+        {
+            QDateTime timestamp;
+            /** Paginates backwards from the newer side of the gap */
+            QString backToken;
+            /** Paginates forwards from the older side of the gap */
+            QString forwardToken;
+        };
+        /** Creates a gap placeholder ordered at the given time */
+        explicit Message(const QDateTime& timestamp);
         virtual ~Message();
 
+        // Messages are allocated from a shared MessagePool
+        static void* operator new(size_t size);
+        static void operator delete(void* ptr, size_t size);
+
+        /** Returns nullptr for gaps */
         QMatrixClient::Event* messageEvent() const;
+        /** Returns an empty string for gaps */
+        QString eventId() const;
+        /**
+         * The sender of a room message, whose name the message is shown
+         * with; an empty string for other events and gaps.
+         */
+        QString senderId() const;
         QDateTime timestamp() const;
 
+        bool isGap() const;
+        /** Returns nullptr unless this is a gap */
+        Gap* gap() const;
+
         bool highlight() const;
         bool isStatusMessage() const;
+        /**
+         * Re-evaluates the highlight with the given matcher;
+         * returns true if it changed.
+         */
+        bool updateHighlight(const HighlightMatcher& matcher, const QString& localUserId);
+
+        /**
+         * What views show for the message, built lazily by
+         * MessageEventModel. Each part is rebuilt only when the
+         * generation it was built for becomes outdated.
+         */
+        struct RenderRecord
+        {
+            QString eventKind;
+            QString displayText;
+            QString author;
+            QVariant content;
+            QString timeText;
+            QDate date;
+            /** The size images are shown at, fitted from the event's */
+            QSize imageSize;
+            bool animated = false;
+            int nameGeneration = -1;
+            int localeGeneration = -1;
+        };
+        RenderRecord& renderRecord() const;
+
+        /**
+         * Time and date texts of all messages are rebuilt after
+         * invalidateLocaleData() is called.
+         */
+        static int localeGeneration();
+        static void invalidateLocaleData();
 
     private:
-        QMatrixClient::Connection* m_connection;
         QMatrixClient::Event* m_event;
         bool m_isHighlight;
         bool m_isStatusMessage;
+        Gap* m_gap;
+        mutable RenderRecord m_renderRecord;
 };
 
 #endif // MESSAGE_H
@@ -0,0 +1,86 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "messagepool.h"
+
+#include <QtCore/QMutexLocker>
+
+#include <new>
+
+namespace
+{
+    const size_t SlotAlignment = 16;
+
+    size_t alignedSize(size_t size)
+    {
+        return (size + SlotAlignment - 1) / SlotAlignment * SlotAlignment;
+    }
+}
+
+MessagePool::MessagePool(size_t slotSize, int slotsPerBlock)
+    : m_slotSize(alignedSize(qMax(slotSize, sizeof(FreeSlot))))
+    , m_slotsPerBlock(slotsPerBlock)
+    , m_freeList(nullptr)
+{
+}
+
+MessagePool::~MessagePool()
+{
+    for( char* block: m_blocks )
+        ::operator delete(block);
+}
+
+void* MessagePool::allocate()
+{
+    QMutexLocker locker(&m_mutex);
+    if( !m_freeList )
+        addBlock();
+    FreeSlot* slot = m_freeList;
+    m_freeList = slot->next;
+    return slot;
+}
+
+void MessagePool::release(void* slot)
+{
+    if( !slot )
+        return;
+    QMutexLocker locker(&m_mutex);
+    FreeSlot* freeSlot = static_cast<FreeSlot*>(slot);
+    freeSlot->next = m_freeList;
+    m_freeList = freeSlot;
+}
+
+size_t MessagePool::slotSize() const
+{
+    return m_slotSize;
+}
+
+void MessagePool::addBlock()
+{
+    char* block = static_cast<char*>(::operator new(m_slotSize * m_slotsPerBlock));
+    m_blocks.append(block);
+    // Chain the new slots in address order so that consecutive
+    // allocations are adjacent in memory.
+    for( int i = m_slotsPerBlock - 1; i >= 0; --i )
+    {
+        FreeSlot* slot = reinterpret_cast<FreeSlot*>(block + i * m_slotSize);
+        slot->next = m_freeList;
+        m_freeList = slot;
+    }
+}
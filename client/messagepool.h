@@ -0,0 +1,62 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef MESSAGEPOOL_H
+#define MESSAGEPOOL_H
+
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+#include <cstddef>
+
+/**
+ * A fixed-size slot allocator for Message objects. Slots are carved out of
+ * large blocks and recycled through a free list, so creating and evicting
+ * lots of messages doesn't fragment the heap. Blocks are never returned
+ * to the system; the pool only grows to the peak number of live messages.
+ * Messages are created on the sync worker thread and deleted on the GUI
+ * thread, hence the mutex.
+ */
+class MessagePool
+{
+    public:
+        explicit MessagePool(size_t slotSize, int slotsPerBlock = 512);
+        ~MessagePool();
+
+        void* allocate();
+        void release(void* slot);
+
+        size_t slotSize() const;
+
+    private:
+        struct FreeSlot
+        {
+            FreeSlot* next;
+        };
+
+        void addBlock();
+
+        const size_t m_slotSize;
+        const int m_slotsPerBlock;
+        QMutex m_mutex;
+        FreeSlot* m_freeList;
+        QVector<char*> m_blocks;
+};
+
+#endif // MESSAGEPOOL_H
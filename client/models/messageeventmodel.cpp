@@ -21,6 +21,9 @@
 
 #include <QtCore/QStringBuilder>
 #include <QtCore/QDebug>
+#include <QtCore/QLocale>
+
+#include <algorithm>
 
 #include "../message.h"
 #include "../quaternionroom.h"
@@ -33,6 +36,32 @@
 #include "lib/events/roomaliasesevent.h"
 #include "lib/events/unknownevent.h"
 
+namespace
+{
+    // Images are shown at most this large, and this large if the event
+    // doesn't tell their size
+    const QSize MaxImageSize { 500, 500 };
+
+    QString membershipText(QMatrixClient::RoomMemberEvent* e)
+    {
+        using namespace QMatrixClient;
+        switch( e->membership() )
+        {
+            case MembershipType::Join:
+                return QString("%1 (%2) joined the room").arg(e->displayName(), e->userId());
+            case MembershipType::Leave:
+                return QString("%1 (%2) left the room").arg(e->displayName(), e->userId());
+            case MembershipType::Ban:
+                return QString("%1 (%2) was banned from the room").arg(e->displayName(), e->userId());
+            case MembershipType::Invite:
+                return QString("%1 (%2) was invited to the room").arg(e->displayName(), e->userId());
+            case MembershipType::Knock:
+                return QString("%1 (%2) knocked").arg(e->displayName(), e->userId());
+        }
+        return "Unknown Event";
+    }
+}
+
 MessageEventModel::MessageEventModel(QObject* parent)
     : QAbstractListModel(parent)
 {
@@ -53,14 +82,23 @@ void MessageEventModel::changeRoom(QMatrixClient::Room* room)
     if( room )
     {
         m_currentRoom = static_cast<QuaternionRoom*>(room);
-        m_currentMessages = m_currentRoom->messages();
-        connect( m_currentRoom, &QuaternionRoom::newMessage, this, &MessageEventModel::newMessage );
+        connect( m_currentRoom, &QuaternionRoom::messagesAboutToBeInserted,
+                 this, &MessageEventModel::messagesAboutToBeInserted );
+        connect( m_currentRoom, &QuaternionRoom::messagesInserted,
+                 this, &MessageEventModel::messagesInserted );
+        connect( m_currentRoom, &QuaternionRoom::messagesAboutToBeRemoved,
+                 this, &MessageEventModel::messagesAboutToBeRemoved );
+        connect( m_currentRoom, &QuaternionRoom::messagesRemoved,
+                 this, &MessageEventModel::messagesRemoved );
+        connect( m_currentRoom, &QuaternionRoom::memberRenamed,
+                 this, &MessageEventModel::memberRenamed );
+        connect( m_currentRoom, &QuaternionRoom::highlightsChanged,
+                 this, &MessageEventModel::highlightsChanged );
         qDebug() << "connected" << room;
     }
     else
     {
         m_currentRoom = nullptr;
-        m_currentMessages.clear();
     }
     endResetModel();
 }
@@ -74,9 +112,9 @@ void MessageEventModel::setConnection(QMatrixClient::Connection* connection)
 // {
 //     if( parent.isValid() )
 //         return QModelIndex();
-//     if( row < 0 || row >= m_currentMessages.count() )
+//     if( row < 0 || row >= rowCount() )
 //         return QModelIndex();
-//     return createIndex(row, column, m_currentMessages.at(row));
+//     return createIndex(row, column, m_currentRoom->messages().at(row));
 // }
 //
 // LogMessageModel::parent(const QModelIndex& index) const
@@ -86,143 +124,154 @@ void MessageEventModel::setConnection(QMatrixClient::Connection* connection)
 
 int MessageEventModel::rowCount(const QModelIndex& parent) const
 {
-    if( parent.isValid() )
+    if( parent.isValid() || !m_currentRoom )
         return 0;
-    return m_currentMessages.count();
+    return m_currentRoom->messages().size();
 }
 
 QVariant MessageEventModel::data(const QModelIndex& index, int role) const
 {
-    using namespace QMatrixClient;
-    if( index.row() < 0 || index.row() >= m_currentMessages.count() || !m_connection )
+    if( !m_currentRoom || !m_connection ||
+            index.row() < 0 || index.row() >= m_currentRoom->messages().size() )
         return QVariant();
 
-    Message* message = m_currentMessages.at(index.row());;
-    Event* event = message->messageEvent();
-
-    if( role == Qt::DisplayRole )
-    {
-        if( event->type() == EventType::RoomMessage )
-        {
-            RoomMessageEvent* e = static_cast<RoomMessageEvent*>(event);
-            User* user = m_connection->user(e->userId());
-            return QString("%1 (%2): %3").arg(user->name()).arg(user->id()).arg(e->body());
-        }
-        if( event->type() == EventType::RoomMember )
-        {
-            RoomMemberEvent* e = static_cast<RoomMemberEvent*>(event);
-            switch( e->membership() )
-            {
-                case MembershipType::Join:
-                    return QString("%1 (%2) joined the room").arg(e->displayName(), e->userId());
-                case MembershipType::Leave:
-                    return QString("%1 (%2) left the room").arg(e->displayName(), e->userId());
-                case MembershipType::Ban:
-                    return QString("%1 (%2) was banned from the room").arg(e->displayName(), e->userId());
-                case MembershipType::Invite:
-                    return QString("%1 (%2) was invited to the room").arg(e->displayName(), e->userId());
-                case MembershipType::Knock:
-                    return QString("%1 (%2) knocked").arg(e->displayName(), e->userId());
-            }
-        }
-        if( event->type() == EventType::RoomAliases )
-        {
-            RoomAliasesEvent* e = static_cast<RoomAliasesEvent*>(event);
-            return QString("Current aliases: %1").arg(e->aliases().join(", "));
-        }
-        return "Unknown Event";
-    }
+    Message* message = m_currentRoom->messages().at(index.row());
 
     if( role == Qt::ToolTipRole )
     {
-        return event->originalJson();
+        return message->isGap() ? QVariant() : message->messageEvent()->originalJson();
     }
 
-    if( role == EventTypeRole )
+    if( role == TimeRole )
     {
-        if( event->type() == EventType::RoomMessage )
-        {
-            auto msgType = static_cast<RoomMessageEvent*>(event)->msgtype();
-            if( msgType == MessageEventType::Image )
-                return "image";
-            else if( msgType == MessageEventType::Emote )
-                return "emote";
-            return "message";
-        }
-        return "other";
+        return message->timestamp();
     }
 
-    if( role == TimeRole )
+    if( role == HighlightRole )
     {
-        return event->timestamp();
+        return message->highlight();
     }
 
+    const Message::RenderRecord& record = renderRecord(message);
+
+    if( role == Qt::DisplayRole )
+        return record.displayText;
+
+    if( role == EventTypeRole )
+        return record.eventKind;
+
+    if( role == TimeTextRole )
+        return record.timeText;
+
     if( role == DateRole )
-    {
-        return event->timestamp().toLocalTime().date();
-    }
+        return record.date;
 
     if( role == AuthorRole )
+        return record.author.isNull() ? QVariant() : record.author;
+
+    if( role == ContentRole )
+        return record.content;
+
+    if( role == ImageSizeRole )
+        return record.imageSize;
+
+    if( role == AnimatedRole )
+        return record.animated;
+
+//     if( event->type() == EventType::Unknown )
+//     {
+//         UnknownEvent* e = static_cast<UnknownEvent*>(event);
+//         return "Unknown Event: " + e->typeString() + "(" + e->content();
+//     }
+    return QVariant();
+}
+
+const Message::RenderRecord& MessageEventModel::renderRecord(Message* message) const
+{
+    using namespace QMatrixClient;
+
+    Message::RenderRecord& record = message->renderRecord();
+    if( message->isGap() )
     {
-        if( event->type() == EventType::RoomMessage )
+        if( record.eventKind.isEmpty() )
         {
-            RoomMessageEvent* e = static_cast<RoomMessageEvent*>(event);
-            return m_currentRoom->roomMembername(e->userId());
+            record.eventKind = "gap";
+            record.displayText = tr("Some messages are not loaded yet");
+            record.content = record.displayText;
         }
-        return QVariant();
+        // The gap before the oldest event is ordered at the epoch and
+        // shouldn't start a date section of its own.
+        if( message->timestamp().toMSecsSinceEpoch() > 0 )
+            record.date = message->timestamp().toLocalTime().date();
+        return record;
     }
+    Event* event = message->messageEvent();
 
-    if( role == ContentRole )
+    if( record.eventKind.isEmpty() )
     {
+        // Parts that only depend on the event itself
+        record.eventKind = "other";
         if( event->type() == EventType::RoomMessage )
         {
             RoomMessageEvent* e = static_cast<RoomMessageEvent*>(event);
+            record.eventKind = "message";
             if( e->msgtype() == MessageEventType::Image )
             {
+                record.eventKind = "image";
                 auto content = static_cast<ImageEventContent*>(e->content());
-                return QUrl("image://mtx/"+content->url.host()+content->url.path());
+                record.content = QUrl("image://mtx/"+content->url.host()+content->url.path());
+                record.imageSize = QSize(content->width, content->height);
+                if( record.imageSize.isEmpty() )
+                    record.imageSize = MaxImageSize;
+                else if( record.imageSize.width() > MaxImageSize.width() ||
+                         record.imageSize.height() > MaxImageSize.height() )
+                    record.imageSize.scale(MaxImageSize, Qt::KeepAspectRatio);
+                record.animated = content->mimetype == "image/gif";
             }
             else if( e->msgtype() == MessageEventType::Emote )
-            {
-                return QString(m_currentRoom->roomMembername(e->userId()) % " " % e->body());
-            }
-            return e->body();
+                record.eventKind = "emote";
         }
-        if( event->type() == EventType::RoomMember )
+        else
         {
-            RoomMemberEvent* e = static_cast<RoomMemberEvent*>(event);
-            switch( e->membership() )
+            QString text = "Unknown Event";
+            if( event->type() == EventType::RoomMember )
+                text = membershipText(static_cast<RoomMemberEvent*>(event));
+            else if( event->type() == EventType::RoomAliases )
             {
-                case MembershipType::Join:
-                    return QString("%1 (%2) joined the room").arg(e->displayName(), e->userId());
-                case MembershipType::Leave:
-                    return QString("%1 (%2) left the room").arg(e->displayName(), e->userId());
-                case MembershipType::Ban:
-                    return QString("%1 (%2) was banned from the room").arg(e->displayName(), e->userId());
-                case MembershipType::Invite:
-                    return QString("%1 (%2) was invited to the room").arg(e->displayName(), e->userId());
-                case MembershipType::Knock:
-                    return QString("%1 (%2) knocked").arg(e->displayName(), e->userId());
+                RoomAliasesEvent* e = static_cast<RoomAliasesEvent*>(event);
+                text = QString("Current aliases: %1").arg(e->aliases().join(", "));
             }
+            record.displayText = text;
+            record.content = text;
         }
-        if( event->type() == EventType::RoomAliases )
-        {
-            RoomAliasesEvent* e = static_cast<RoomAliasesEvent*>(event);
-            return QString("Current aliases: %1").arg(e->aliases().join(", "));
-        }
-        return "Unknown Event";
     }
 
-    if( role == HighlightRole )
+    if( record.localeGeneration != Message::localeGeneration() )
     {
-        return message->highlight();
+        const QDateTime localTime = event->timestamp().toLocalTime();
+        record.timeText = QLocale().toString(localTime.time(), "'<'hh:mm:ss'>'");
+        record.date = localTime.date();
+        record.localeGeneration = Message::localeGeneration();
     }
-//     if( event->type() == EventType::Unknown )
-//     {
-//         UnknownEvent* e = static_cast<UnknownEvent*>(event);
-//         return "Unknown Event: " + e->typeString() + "(" + e->content();
-//     }
-    return QVariant();
+
+    if( event->type() == EventType::RoomMessage )
+    {
+        // Parts that depend on the sender's current name
+        RoomMessageEvent* e = static_cast<RoomMessageEvent*>(event);
+        const int nameGeneration = m_currentRoom->memberGeneration(e->userId());
+        if( record.nameGeneration != nameGeneration )
+        {
+            User* user = m_connection->user(e->userId());
+            record.displayText = QString("%1 (%2): %3").arg(user->name()).arg(user->id()).arg(e->body());
+            record.author = m_currentRoom->roomMembername(e->userId());
+            if( e->msgtype() == MessageEventType::Emote )
+                record.content = QString(record.author % " " % e->body());
+            else if( e->msgtype() != MessageEventType::Image )
+                record.content = e->body();
+            record.nameGeneration = nameGeneration;
+        }
+    }
+    return record;
 }
 
 QHash<int, QByteArray> MessageEventModel::roleNames() const
@@ -234,19 +283,73 @@ QHash<int, QByteArray> MessageEventModel::roleNames() const
     roles[AuthorRole] = "author";
     roles[ContentRole] = "content";
     roles[HighlightRole] = "highlight";
+    roles[TimeTextRole] = "timeText";
+    roles[ImageSizeRole] = "imageSize";
+    roles[AnimatedRole] = "animated";
     return roles;
 }
 
-void MessageEventModel::newMessage(Message* message)
+void MessageEventModel::messagesAboutToBeInserted(int first, int last)
+{
+    beginInsertRows(QModelIndex(), first, last);
+}
+
+void MessageEventModel::messagesInserted()
+{
+    endInsertRows();
+}
+
+void MessageEventModel::messagesAboutToBeRemoved(int first, int last)
 {
-    //qDebug() << "Message: " << message;
-    if( message->messageEvent()->type() == QMatrixClient::EventType::Typing )
+    beginRemoveRows(QModelIndex(), first, last);
+}
+
+void MessageEventModel::messagesRemoved()
+{
+    endRemoveRows();
+}
+
+void MessageEventModel::memberRenamed(QMatrixClient::User* user)
+{
+    // Only the records of the renamed member's messages get rebuilt, and
+    // only when views actually ask for them.
+    QVector<int> rows;
+    for( Message* message: m_currentRoom->messages().messagesFrom(user->id()) )
+        rows.append(m_currentRoom->messages().indexOf(message));
+    std::sort(rows.begin(), rows.end());
+    // Adjacent rows go in one range
+    for( int i = 0; i < rows.size(); )
     {
-        return;
+        int end = i + 1;
+        while( end < rows.size() && rows.at(end) == rows.at(end - 1) + 1 )
+            ++end;
+        emit dataChanged(index(rows.at(i)), index(rows.at(end - 1)),
+                         { Qt::DisplayRole, AuthorRole, ContentRole });
+        i = end;
     }
-    auto pos = std::distance(m_currentMessages.begin(),
-            QMatrixClient::findInsertionPos(m_currentMessages, message));
-    beginInsertRows(QModelIndex(), pos, pos);
-    m_currentMessages.insert(pos, message);
-    endInsertRows();
+}
+
+void MessageEventModel::highlightsChanged(QList<Message*> messages)
+{
+    for( Message* message: messages )
+    {
+        const int row = m_currentRoom->messages().indexOf(message);
+        if( row >= 0 )
+            emit dataChanged(index(row), index(row), { HighlightRole });
+    }
+}
+
+void MessageEventModel::invalidateLocaleData()
+{
+    Message::invalidateLocaleData();
+    if( rowCount(QModelIndex()) > 0 )
+        emit dataChanged(index(0), index(rowCount(QModelIndex()) - 1),
+                         { TimeTextRole, DateRole });
+}
+
+int MessageEventModel::rowForEvent(const QString& eventId) const
+{
+    if( !m_currentRoom )
+        return -1;
+    return m_currentRoom->messages().indexOf(eventId);
 }
@@ -23,15 +23,21 @@
 #include <QtCore/QAbstractListModel>
 #include <QtCore/QModelIndex>
 
+#include "../message.h"
+
 namespace QMatrixClient
 {
     class Room;
     class Connection;
+    class User;
 }
 
-class Message;
 class QuaternionRoom;
 
+/**
+ * A view over the current room's timeline: rows are the room's own
+ * messages(), nothing is copied when the room changes.
+ */
 class MessageEventModel: public QAbstractListModel
 {
         Q_OBJECT
@@ -42,7 +48,10 @@ class MessageEventModel: public QAbstractListModel
             DateRole,
             AuthorRole,
             ContentRole,
-            HighlightRole
+            HighlightRole,
+            TimeTextRole,
+            ImageSizeRole,
+            AnimatedRole
         };
 
         MessageEventModel(QObject* parent = nullptr);
@@ -50,6 +59,10 @@ class MessageEventModel: public QAbstractListModel
 
         void setConnection(QMatrixClient::Connection* connection);
         void changeRoom(QMatrixClient::Room* room);
+        /** Rebuilds time and date texts, e.g. after a locale change */
+        void invalidateLocaleData();
+        /** Returns the row of the event, or -1 if it isn't loaded */
+        int rowForEvent(const QString& eventId) const;
 
         //override QModelIndex index(int row, int column, const QModelIndex& parent=QModelIndex()) const;
         //override QModelIndex parent(const QModelIndex& index) const;
@@ -57,13 +70,19 @@ class MessageEventModel: public QAbstractListModel
         QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
         QHash<int, QByteArray> roleNames() const override;
 
-    public slots:
-        void newMessage(Message* messageEvent);
+    private slots:
+        void messagesAboutToBeInserted(int first, int last);
+        void messagesInserted();
+        void messagesAboutToBeRemoved(int first, int last);
+        void messagesRemoved();
+        void memberRenamed(QMatrixClient::User* user);
+        void highlightsChanged(QList<Message*> messages);
 
     private:
+        const Message::RenderRecord& renderRecord(Message* message) const;
+
         QMatrixClient::Connection* m_connection;
         QuaternionRoom* m_currentRoom;
-        QList<Message*> m_currentMessages;
 };
 
 #endif // LOGMESSAGEMODEL_H
@@ -0,0 +1,224 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "publicroomsmodel.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtNetwork/QNetworkReply>
+
+#include "../quaternionconnection.h"
+
+namespace
+{
+    // The number of rooms requested at once
+    const int PageSize = 50;
+    // The number of pages kept in the cache, across all search terms
+    const int CachedPages = 40;
+}
+
+PublicRoomsModel::PublicRoomsModel(QObject* parent)
+    : QAbstractListModel(parent)
+    , m_connection(nullptr)
+    , m_atEnd(false)
+    , m_totalEstimate(-1)
+    , m_reply(nullptr)
+    , m_pages(CachedPages)
+{
+}
+
+PublicRoomsModel::~PublicRoomsModel()
+{
+    cancelRequest();
+}
+
+void PublicRoomsModel::setConnection(QuaternionConnection* connection)
+{
+    beginResetModel();
+    cancelRequest();
+    m_connection = connection;
+    m_pages.clear();
+    m_rooms.clear();
+    m_nextBatch.clear();
+    m_atEnd = false;
+    m_totalEstimate = -1;
+    endResetModel();
+}
+
+void PublicRoomsModel::setFilter(const QString& filter)
+{
+    if( filter == m_filter )
+        return;
+    beginResetModel();
+    cancelRequest();
+    m_filter = filter;
+    m_rooms.clear();
+    m_nextBatch.clear();
+    m_atEnd = false;
+    m_totalEstimate = -1;
+    endResetModel();
+    // Views only ask for more once they have something to scroll
+    fetchMore(QModelIndex());
+}
+
+QString PublicRoomsModel::filter() const
+{
+    return m_filter;
+}
+
+bool PublicRoomsModel::isLoading() const
+{
+    return m_reply != nullptr;
+}
+
+int PublicRoomsModel::totalEstimate() const
+{
+    return m_totalEstimate;
+}
+
+int PublicRoomsModel::rowCount(const QModelIndex& parent) const
+{
+    if( parent.isValid() )
+        return 0;
+    return m_rooms.size();
+}
+
+QVariant PublicRoomsModel::data(const QModelIndex& index, int role) const
+{
+    if( index.row() < 0 || index.row() >= m_rooms.size() )
+        return QVariant();
+
+    const PublicRoom& room = m_rooms.at(index.row());
+    if( role == Qt::DisplayRole )
+    {
+        const QString name = !room.name.isEmpty() ? room.name :
+                             !room.alias.isEmpty() ? room.alias : room.roomId;
+        return tr("%1 (%2 members)").arg(name).arg(room.memberCount);
+    }
+    if( role == Qt::ToolTipRole )
+    {
+        QString result = QString("<b>%1</b><br>").arg(room.alias.isEmpty() ? room.roomId : room.alias);
+        if( !room.topic.isEmpty() )
+            result += room.topic.toHtmlEscaped();
+        return result;
+    }
+    if( role == RoomIdRole )
+        return room.roomId;
+    if( role == AliasRole )
+        return room.alias;
+    if( role == MemberCountRole )
+        return room.memberCount;
+    return QVariant();
+}
+
+bool PublicRoomsModel::canFetchMore(const QModelIndex& parent) const
+{
+    return !parent.isValid() && m_connection && !m_atEnd;
+}
+
+void PublicRoomsModel::fetchMore(const QModelIndex& parent)
+{
+    if( !canFetchMore(parent) || m_reply )
+        return;
+
+    const QString key = pageKey(m_nextBatch);
+    if( const Page* page = m_pages.object(key) )
+    {
+        appendPage(*page);
+        return;
+    }
+
+    QJsonObject body { { "limit", PageSize } };
+    if( !m_nextBatch.isEmpty() )
+        body.insert("since", m_nextBatch);
+    if( !m_filter.isEmpty() )
+        body.insert("filter", QJsonObject { { "generic_search_term", m_filter } });
+    m_reply = m_connection->apiPost("/publicRooms", body);
+    m_replyKey = key;
+    connect( m_reply, &QNetworkReply::finished, this, &PublicRoomsModel::replyFinished );
+    emit loadingChanged(true);
+}
+
+void PublicRoomsModel::replyFinished()
+{
+    QNetworkReply* reply = m_reply;
+    m_reply = nullptr;
+    reply->deleteLater();
+    emit loadingChanged(false);
+    if( reply->error() != QNetworkReply::NoError )
+    {
+        qDebug() << "Public rooms request failed:" << reply->errorString();
+        emit requestFailed(reply->errorString());
+        return;
+    }
+
+    const QJsonObject json = QJsonDocument::fromJson(reply->readAll()).object();
+    Page* page = new Page;
+    page->nextBatch = json.value("next_batch").toString();
+    page->totalEstimate = json.value("total_room_count_estimate").toInt(-1);
+    for( const QJsonValue& value: json.value("chunk").toArray() )
+    {
+        const QJsonObject room = value.toObject();
+        QString alias = room.value("canonical_alias").toString();
+        if( alias.isEmpty() )
+            alias = room.value("aliases").toArray().first().toString();
+        page->rooms.append({ room.value("room_id").toString(),
+                             room.value("name").toString(),
+                             alias,
+                             room.value("topic").toString(),
+                             room.value("num_joined_members").toInt() });
+    }
+    appendPage(*page);
+    m_pages.insert(m_replyKey, page);
+}
+
+QString PublicRoomsModel::pageKey(const QString& since) const
+{
+    return m_filter + '\n' + since;
+}
+
+void PublicRoomsModel::appendPage(const Page& page)
+{
+    // A page ends the listing if it's the last one or the server has
+    // nothing more for it
+    m_atEnd = page.nextBatch.isEmpty() || page.rooms.isEmpty();
+    m_nextBatch = page.nextBatch;
+    if( page.totalEstimate >= 0 )
+        m_totalEstimate = page.totalEstimate;
+    if( page.rooms.isEmpty() )
+        return;
+    beginInsertRows(QModelIndex(), m_rooms.size(), m_rooms.size() + page.rooms.size() - 1);
+    m_rooms << page.rooms;
+    endInsertRows();
+}
+
+void PublicRoomsModel::cancelRequest()
+{
+    if( !m_reply )
+        return;
+    QNetworkReply* reply = m_reply;
+    m_reply = nullptr;
+    // finished() from abort() must not reach replyFinished()
+    reply->disconnect(this);
+    reply->abort();
+    reply->deleteLater();
+    emit loadingChanged(false);
+}
@@ -0,0 +1,107 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef PUBLICROOMSMODEL_H
+#define PUBLICROOMSMODEL_H
+
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QCache>
+#include <QtCore/QVector>
+
+class QuaternionConnection;
+class QNetworkReply;
+
+/**
+ * The public room directory of the homeserver, optionally filtered by a
+ * search term that is matched on the server. Pages are requested as views
+ * scroll to the end (via canFetchMore()/fetchMore()), so only as much of
+ * the directory as is looked at gets downloaded; pages already seen are
+ * cached for when the same term comes up again.
+ */
+class PublicRoomsModel: public QAbstractListModel
+{
+        Q_OBJECT
+    public:
+        enum Roles {
+            RoomIdRole = Qt::UserRole + 1,
+            AliasRole,
+            MemberCountRole
+        };
+
+        PublicRoomsModel(QObject* parent = nullptr);
+        virtual ~PublicRoomsModel();
+
+        void setConnection(QuaternionConnection* connection);
+        /**
+         * Restarts the listing with the rooms matching the term; the
+         * request for the previous term is cancelled if still running.
+         */
+        void setFilter(const QString& filter);
+        QString filter() const;
+
+        /** Whether a page is being requested */
+        bool isLoading() const;
+        /** The server's estimate of the number of matching rooms, or -1 */
+        int totalEstimate() const;
+
+        QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+        int rowCount(const QModelIndex& parent=QModelIndex()) const override;
+        bool canFetchMore(const QModelIndex& parent) const override;
+        void fetchMore(const QModelIndex& parent) override;
+
+    signals:
+        void loadingChanged(bool loading);
+        void requestFailed(QString error);
+
+    private slots:
+        void replyFinished();
+
+    private:
+        struct PublicRoom
+        {
+            QString roomId;
+            QString name;
+            QString alias;
+            QString topic;
+            int memberCount;
+        };
+        struct Page
+        {
+            QVector<PublicRoom> rooms;
+            QString nextBatch;
+            int totalEstimate;
+        };
+
+        QString pageKey(const QString& since) const;
+        void appendPage(const Page& page);
+        void cancelRequest();
+
+        QuaternionConnection* m_connection;
+        QString m_filter;
+        QVector<PublicRoom> m_rooms;
+        QString m_nextBatch;
+        bool m_atEnd;
+        int m_totalEstimate;
+        QNetworkReply* m_reply;
+        QString m_replyKey;
+        /** Pages by filter and pagination token */
+        QCache<QString, Page> m_pages;
+};
+
+#endif // PUBLICROOMSMODEL_H
@@ -24,15 +24,45 @@
 #include <QtGui/QIcon>
 
 #include <QtCore/QDebug>
+#include <QtCore/QSet>
+#include <QtCore/QSettings>
+#include <QtCore/QTimer>
+
+#include <algorithm>
 
 #include "lib/connection.h"
 #include "lib/room.h"
 #include "../quaternionroom.h"
+#include "../quaternionconnection.h"
+
+namespace
+{
+    int joinStateRank(QMatrixClient::JoinState state)
+    {
+        switch( state )
+        {
+            case QMatrixClient::JoinState::Invite:
+                return 0;
+            case QMatrixClient::JoinState::Join:
+                return 1;
+            case QMatrixClient::JoinState::Leave:
+                return 2;
+        }
+        return 3;
+    }
+}
 
 RoomListModel::RoomListModel(QObject* parent)
     : QAbstractListModel(parent)
     , m_connection(nullptr)
-{ }
+{
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(0);
+    connect( m_flushTimer, &QTimer::timeout, this, &RoomListModel::flushChanges );
+
+    m_sortOrder = SortOrder(QSettings().value("roomlist/sort_order", ByActivity).toInt());
+}
 
 RoomListModel::~RoomListModel()
 { }
@@ -43,17 +73,24 @@ void RoomListModel::setConnection(QMatrixClient::Connection* connection)
         return;
 
     beginResetModel();
-    for( QuaternionRoom* room: m_rooms )
-        room->disconnect( this );
+    if( m_connection )
+        m_connection->disconnect( this );
 
     m_rooms.clear();
+    m_rows.clear();
+    m_changes.clear();
 
     m_connection = connection;
     if (m_connection)
     {
         connect( m_connection, &QMatrixClient::Connection::newRoom, this, &RoomListModel::addRoom );
+        connect( static_cast<QuaternionConnection*>(m_connection), &QuaternionConnection::roomSummaryChanged,
+                 this, &RoomListModel::roomSummaryChanged );
         for( QMatrixClient::Room* r: m_connection->roomMap() )
             doAddRoom(r);
+        std::stable_sort(m_rooms.begin(), m_rooms.end(),
+            [this](QuaternionRoom* a, QuaternionRoom* b) { return lessThan(a, b); });
+        updateRows(0, m_rooms.size() - 1);
     }
 
     endResetModel();
@@ -64,23 +101,150 @@ QuaternionRoom* RoomListModel::roomAt(int row)
     return m_rooms.at(row);
 }
 
+int RoomListModel::rowOf(QuaternionRoom* room) const
+{
+    return m_rows.value(room, -1);
+}
+
+RoomListModel::SortOrder RoomListModel::sortOrder() const
+{
+    return m_sortOrder;
+}
+
+void RoomListModel::setSortOrder(SortOrder order)
+{
+    if( order == m_sortOrder )
+        return;
+    m_sortOrder = order;
+    QSettings().setValue("roomlist/sort_order", int(order));
+    resort();
+}
+
 void RoomListModel::addRoom(QMatrixClient::Room* room)
 {
-    beginInsertRows(QModelIndex(), m_rooms.count(), m_rooms.count());
+    QuaternionRoom* qRoom = static_cast<QuaternionRoom*>(room);
+    const int row = int(std::upper_bound(m_rooms.begin(), m_rooms.end(), qRoom,
+        [this](QuaternionRoom* a, QuaternionRoom* b) { return lessThan(a, b); }) - m_rooms.begin());
+    beginInsertRows(QModelIndex(), row, row);
     doAddRoom(room);
+    m_rooms.move(m_rooms.size() - 1, row);
+    updateRows(row, m_rooms.size() - 1);
     endInsertRows();
 }
 
 void RoomListModel::doAddRoom(QMatrixClient::Room* r)
 {
     QuaternionRoom* room = static_cast<QuaternionRoom*>(r);
+    m_rows.insert(room, m_rooms.size());
     m_rooms.append(room);
-    connect( room, &QuaternionRoom::displaynameChanged,
-        this, &RoomListModel::displaynameChanged );
-    connect( room, &QuaternionRoom::unreadMessagesChanged,
-        this, &RoomListModel::unreadMessagesChanged );
-    connect( room, &QuaternionRoom::notificationCountChanged,
-        this, &RoomListModel::unreadMessagesChanged );
+}
+
+bool RoomListModel::lessThan(QuaternionRoom* a, QuaternionRoom* b) const
+{
+    switch( m_sortOrder )
+    {
+        case UnreadFirst:
+            if( (a->highlightCount() > 0) != (b->highlightCount() > 0) )
+                return a->highlightCount() > 0;
+            if( a->hasUnreadMessages() != b->hasUnreadMessages() )
+                return a->hasUnreadMessages();
+            break;
+        case ByJoinState:
+            if( a->joinState() != b->joinState() )
+                return joinStateRank(a->joinState()) < joinStateRank(b->joinState());
+            break;
+        case ByActivity:
+            break;
+    }
+    const QDateTime activityA = a->lastActivity();
+    const QDateTime activityB = b->lastActivity();
+    if( activityA.isValid() != activityB.isValid() )
+        return activityA.isValid();
+    if( activityA != activityB )
+        return activityA > activityB;
+    return a->displayName().localeAwareCompare(b->displayName()) < 0;
+}
+
+void RoomListModel::repositionRooms(QList<QuaternionRoom*> rooms)
+{
+    // Many single-row moves cost more than sorting everything at once
+    if( rooms.size() > m_rooms.size() / 4 )
+    {
+        resort();
+        return;
+    }
+
+    auto less = [this](QuaternionRoom* a, QuaternionRoom* b) { return lessThan(a, b); };
+    std::sort(rooms.begin(), rooms.end(), less);
+    const QSet<QuaternionRoom*> moving = rooms.toSet();
+
+    // The other rooms are still sorted; merging the moving ones into them
+    // gives each moving room the room it should follow.
+    QVector<QuaternionRoom*> predecessors(rooms.size(), nullptr);
+    QuaternionRoom* previous = nullptr;
+    int next = 0;
+    for( QuaternionRoom* room: m_rooms )
+    {
+        if( moving.contains(room) )
+            continue;
+        for( ; next < rooms.size() && less(rooms.at(next), room); ++next )
+        {
+            predecessors[next] = previous;
+            previous = rooms.at(next);
+        }
+        previous = room;
+    }
+    for( ; next < rooms.size(); ++next )
+    {
+        predecessors[next] = previous;
+        previous = rooms.at(next);
+    }
+
+    // Placing the rooms in sorted order right after their predecessors,
+    // which are in place by then, yields the sorted list.
+    for( int i = 0; i < rooms.size(); ++i )
+    {
+        const int from = rowOf(rooms.at(i));
+        const int to = predecessors.at(i) ? rowOf(predecessors.at(i)) + 1 : 0;
+        moveRow(from, to);
+    }
+}
+
+void RoomListModel::moveRow(int from, int to)
+{
+    // "to" is the row to move before, as in beginMoveRows()
+    if( to == from || to == from + 1 )
+        return;
+    beginMoveRows(QModelIndex(), from, from, QModelIndex(), to);
+    const int newRow = to > from ? to - 1 : to;
+    m_rooms.move(from, newRow);
+    updateRows(qMin(from, newRow), qMax(from, newRow));
+    endMoveRows();
+}
+
+void RoomListModel::resort()
+{
+    emit layoutAboutToBeChanged();
+    const QModelIndexList oldIndexes = persistentIndexList();
+    QList<QuaternionRoom*> persistentRooms;
+    for( const QModelIndex& index: oldIndexes )
+        persistentRooms.append(m_rooms.at(index.row()));
+
+    std::stable_sort(m_rooms.begin(), m_rooms.end(),
+        [this](QuaternionRoom* a, QuaternionRoom* b) { return lessThan(a, b); });
+    updateRows(0, m_rooms.size() - 1);
+
+    QModelIndexList newIndexes;
+    for( QuaternionRoom* room: persistentRooms )
+        newIndexes.append(index(rowOf(room)));
+    changePersistentIndexList(oldIndexes, newIndexes);
+    emit layoutChanged();
+}
+
+void RoomListModel::updateRows(int first, int last)
+{
+    for( int row = first; row <= last; ++row )
+        m_rows.insert(m_rooms.at(row), row);
 }
 
 int RoomListModel::rowCount(const QModelIndex& parent) const
@@ -140,14 +304,56 @@ QVariant RoomListModel::data(const QModelIndex& index, int role) const
     return QVariant();
 }
 
-void RoomListModel::displaynameChanged(QMatrixClient::Room* room)
+void RoomListModel::roomSummaryChanged(QuaternionRoom* room, int changes)
 {
-    int row = m_rooms.indexOf(static_cast<QuaternionRoom*>(room));
-    emit dataChanged(index(row), index(row));
+    QVector<int> roles;
+    if( changes & QuaternionRoom::NameChange )
+        roles << Qt::DisplayRole << Qt::ToolTipRole;
+    if( changes & (QuaternionRoom::UnreadChange | QuaternionRoom::HighlightChange) )
+        roles << Qt::ForegroundRole;
+    if( changes & QuaternionRoom::JoinStateChange )
+        roles << Qt::DecorationRole << Qt::ToolTipRole;
+    // A change of the last activity only moves the row, if anything
+    roomChanged(room, roles);
 }
 
-void RoomListModel::unreadMessagesChanged(QMatrixClient::Room* room)
+void RoomListModel::roomChanged(QuaternionRoom* room, const QVector<int>& roles)
 {
-    int row = m_rooms.indexOf(static_cast<QuaternionRoom*>(room));
-    emit dataChanged(index(row), index(row));
+    QVector<int>& pending = m_changes[room];
+    for( int role: roles )
+        if( !pending.contains(role) )
+            pending.append(role);
+    if( !m_flushTimer->isActive() )
+        m_flushTimer->start();
+}
+
+void RoomListModel::flushChanges()
+{
+    repositionRooms(m_changes.keys());
+
+    QVector<int> rows;
+    rows.reserve(m_changes.size());
+    for( auto it = m_changes.begin(); it != m_changes.end(); ++it )
+    {
+        const int row = rowOf(it.key());
+        if( row >= 0 && !it.value().isEmpty() )
+            rows.append(row);
+    }
+    std::sort(rows.begin(), rows.end());
+
+    // One dataChanged() per run of adjacent rows, with the union of
+    // their changed roles
+    int i = 0;
+    while( i < rows.size() )
+    {
+        QVector<int> roles = m_changes.value(m_rooms.at(rows.at(i)));
+        int end = i + 1;
+        for( ; end < rows.size() && rows.at(end) == rows.at(end - 1) + 1; ++end )
+            for( int role: m_changes.value(m_rooms.at(rows.at(end))) )
+                if( !roles.contains(role) )
+                    roles.append(role);
+        emit dataChanged(index(rows.at(i)), index(rows.at(end - 1)), roles);
+        i = end;
+    }
+    m_changes.clear();
 }
@@ -21,6 +21,8 @@
 #define ROOMLISTMODEL_H
 
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
 
 namespace QMatrixClient
 {
@@ -29,30 +31,69 @@ namespace QMatrixClient
 }
 
 class QuaternionRoom;
+class QTimer;
 
 class RoomListModel: public QAbstractListModel
 {
         Q_OBJECT
     public:
+        enum SortOrder {
+            /** Most recent activity first */
+            ByActivity,
+            /** Rooms with highlights, then with unread messages first */
+            UnreadFirst,
+            /** Invitations, then joined, then left rooms */
+            ByJoinState
+        };
+
         RoomListModel(QObject* parent = nullptr);
         virtual ~RoomListModel();
 
         void setConnection(QMatrixClient::Connection* connection);
         QuaternionRoom* roomAt(int row);
+        /** Returns the row of the room, or -1 */
+        int rowOf(QuaternionRoom* room) const;
+
+        /**
+         * Rooms are kept in this order incrementally: a room whose sort
+         * key changes is moved to its new row, the rest stay in place.
+         * Stored in the settings.
+         */
+        SortOrder sortOrder() const;
+        void setSortOrder(SortOrder order);
 
         QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
         int rowCount(const QModelIndex& parent=QModelIndex()) const override;
 
     private slots:
-        void displaynameChanged(QMatrixClient::Room* room);
-        void unreadMessagesChanged(QMatrixClient::Room* room);
+        void roomSummaryChanged(QuaternionRoom* room, int changes);
         void addRoom(QMatrixClient::Room* room);
+        void flushChanges();
 
     private:
         QMatrixClient::Connection* m_connection;
         QList<QuaternionRoom*> m_rooms;
+        QHash<QuaternionRoom*, int> m_rows;
+        /**
+         * Roles changed since the last flushChanges(), by room; rooms
+         * listed here are also moved if their sort key has changed.
+         */
+        QHash<QuaternionRoom*, QVector<int>> m_changes;
+        QTimer* m_flushTimer;
+        SortOrder m_sortOrder;
 
         void doAddRoom(QMatrixClient::Room* r);
+        bool lessThan(QuaternionRoom* a, QuaternionRoom* b) const;
+        /** Moves the given rooms, and only them, to their sorted rows */
+        void repositionRooms(QList<QuaternionRoom*> rooms);
+        void moveRow(int from, int to);
+        void resort();
+        void updateRows(int first, int last);
+        /**
+         * Records a change to be reported by flushChanges() on the next
+         * event loop turn, merged with other changes to adjacent rows.
+         */
+        void roomChanged(QuaternionRoom* room, const QVector<int>& roles);
 };
 
 #endif // ROOMLISTMODEL_H
@@ -20,18 +20,47 @@
 #include "userlistmodel.h"
 
 #include <QtCore/QDebug>
-#include <QtCore/QVector>
+#include <QtCore/QTimer>
 #include <QtGui/QPixmap>
 
+#include <algorithm>
+
 #include "lib/connection.h"
 #include "lib/room.h"
 #include "lib/user.h"
+#include "../quaternionconnection.h"
+#include "../avatarcache.h"
+#include "../quaternionroom.h"
+
+namespace
+{
+    // The number of rows exposed to views at once
+    const int PageSize = 200;
+    const QSize AvatarSize { 25, 25 };
+}
+
+bool UserListModel::Member::operator<(const Member& other) const
+{
+    if( powerLevel != other.powerLevel )
+        return powerLevel > other.powerLevel;
+    if( sortName != other.sortName )
+        return sortName < other.sortName;
+    return user < other.user;
+}
 
 UserListModel::UserListModel(QObject* parent)
     : QAbstractListModel(parent)
     , m_connection(nullptr)
     , m_currentRoom(nullptr)
-{ }
+    , m_loadedCount(0)
+{
+    // Members join in bursts (most of all on the initial sync); they're
+    // sorted in together once the burst is processed.
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(0);
+    connect( m_flushTimer, &QTimer::timeout, this, &UserListModel::flushAddedUsers );
+}
 
 UserListModel::~UserListModel()
 {
@@ -41,32 +70,58 @@ void UserListModel::setConnection(QMatrixClient::Connection* connection)
 {
     setRoom(nullptr);
 
+    if( m_connection )
+    {
+        m_connection->disconnect( this );
+        static_cast<QuaternionConnection*>(m_connection)->avatarCache()->disconnect( this );
+    }
     m_connection = connection;
+    // Avatar changes of all users come through the connection, so there's
+    // nothing to connect per user on room switches.
+    if( m_connection )
+    {
+        auto connection = static_cast<QuaternionConnection*>(m_connection);
+        connect( connection, &QuaternionConnection::userAvatarChanged,
+                 this, &UserListModel::avatarChanged );
+        connect( connection->avatarCache(), &AvatarCache::avatarReady,
+                 this, &UserListModel::avatarReady );
+    }
 }
 
 void UserListModel::setRoom(QMatrixClient::Room* room)
 {
-    beginResetModel();
     if( m_currentRoom )
-    {
         m_currentRoom->disconnect( this );
-        for( QMatrixClient::User* user: m_users )
-            user->disconnect( this );
-        m_users.clear();
-    }
-    m_currentRoom = room;
+    m_currentRoom = static_cast<QuaternionRoom*>(room);
     if( m_currentRoom )
     {
         connect( m_currentRoom, &QMatrixClient::Room::userAdded, this, &UserListModel::userAdded );
         connect( m_currentRoom, &QMatrixClient::Room::userRemoved, this, &UserListModel::userRemoved );
         connect( m_currentRoom, &QMatrixClient::Room::memberRenamed, this, &UserListModel::memberRenamed );
-        m_users = m_currentRoom->users();
-        for( QMatrixClient::User* user: m_users )
-        {
-            connect( user, &QMatrixClient::User::avatarChanged, this, &UserListModel::avatarChanged );
-        }
-        qDebug() << m_users.count() << "user(s) in the room";
+        connect( m_currentRoom, &QuaternionRoom::powerLevelsChanged, this, &UserListModel::powerLevelsChanged );
     }
+    rebuild();
+    qDebug() << m_members.count() << "user(s) in the room";
+}
+
+void UserListModel::setFilter(const QString& filter)
+{
+    const QString term = filter.toCaseFolded();
+    if( term == m_filter )
+        return;
+
+    beginResetModel();
+    // Narrowing the term only needs to look at the current matches
+    const QVector<Member>& source =
+        !m_filter.isEmpty() && term.contains(m_filter) ? m_matches : m_members;
+    QVector<Member> matches;
+    m_filter = term;
+    if( !m_filter.isEmpty() )
+        for( const Member& member: source )
+            if( matchesFilter(member) )
+                matches.append(member);
+    m_matches.swap(matches);
+    m_loadedCount = qMin(PageSize, shown().size());
     endResetModel();
 }
 
@@ -75,19 +130,35 @@ QVariant UserListModel::data(const QModelIndex& index, int role) const
     if( !index.isValid() )
         return QVariant();
 
-    if( index.row() >= m_users.count() )
+    if( index.row() >= rowCount() )
     {
-        qDebug() << "UserListModel, something's wrong: index.row() >= m_users.count()";
+        qDebug() << "UserListModel, something's wrong: index.row() >= rowCount()";
         return QVariant();
     }
-    QMatrixClient::User* user = m_users.at(index.row());
+    QMatrixClient::User* user = shown().at(index.row()).user;
     if( role == Qt::DisplayRole )
     {
         return m_currentRoom->roomMembername(user);
     }
     if( role == Qt::DecorationRole )
     {
-        return user->avatar(25,25);
+        auto connection = static_cast<QuaternionConnection*>(m_connection);
+        const QUrl url = m_currentRoom->memberAvatarUrl(user->id());
+        const QPixmap avatar = connection->avatarCache()->avatar(url, AvatarSize);
+        if( avatar.isNull() )
+        {
+            if( !url.isEmpty() )
+                m_pendingAvatars[url].insert(user);
+            return QVariant();
+        }
+        return avatar;
+    }
+    if( role == Qt::ToolTipRole )
+    {
+        const int powerLevel = shown().at(index.row()).powerLevel;
+        if( powerLevel != 0 )
+            return tr("%1<br>Power level: %2").arg(user->id()).arg(powerLevel);
+        return user->id();
     }
     return QVariant();
 }
@@ -97,37 +168,199 @@ int UserListModel::rowCount(const QModelIndex& parent) const
     if( parent.isValid() )
         return 0;
 
-    return m_users.count();
+    return m_loadedCount;
 }
 
-void UserListModel::userAdded(QMatrixClient::User* user)
+bool UserListModel::canFetchMore(const QModelIndex& parent) const
 {
-    beginInsertRows(QModelIndex(), m_users.count(), m_users.count());
-    m_users.append(user);
+    return !parent.isValid() && m_loadedCount < shown().size();
+}
+
+void UserListModel::fetchMore(const QModelIndex& parent)
+{
+    if( !canFetchMore(parent) )
+        return;
+    const int count = qMin(PageSize, shown().size() - m_loadedCount);
+    beginInsertRows(QModelIndex(), m_loadedCount, m_loadedCount + count - 1);
+    m_loadedCount += count;
     endInsertRows();
-    connect( user, &QMatrixClient::User::avatarChanged, this, &UserListModel::avatarChanged );
+}
+
+void UserListModel::userAdded(QMatrixClient::User* user)
+{
+    m_addedUsers.append(user);
+    if( !m_flushTimer->isActive() )
+        m_flushTimer->start();
+}
+
+void UserListModel::flushAddedUsers()
+{
+    QList<QMatrixClient::User*> users;
+    users.swap(m_addedUsers);
+    // Inserting one by one costs a move of the tail each time
+    if( users.size() > 64 && users.size() > m_members.size() / 8 )
+    {
+        rebuild();
+        return;
+    }
+    for( QMatrixClient::User* user: users )
+        if( !m_keys.contains(user) )
+            insertMember(makeMember(user));
 }
 
 void UserListModel::userRemoved(QMatrixClient::User* user)
 {
-    int pos = m_users.indexOf(user);
-    beginRemoveRows(QModelIndex(), pos, pos);
-    m_users.removeAt(pos);
-    endRemoveRows();
-    disconnect( user, &QMatrixClient::User::avatarChanged, this, &UserListModel::avatarChanged );
+    if( m_addedUsers.removeOne(user) )
+        return;
+    removeMember(user);
 }
 
-void UserListModel::memberRenamed(QMatrixClient::User *user)
+void UserListModel::memberRenamed(QMatrixClient::User* user)
 {
-    int pos = m_users.indexOf(user);
-    if ( pos > -1 )
-        emit dataChanged(index(pos), index(pos), {Qt::DisplayRole} );
+    if( !m_keys.contains(user) )
+        return;
+    const Member member = makeMember(user);
+    const Member& old = m_keys[user];
+    if( member.sortName == old.sortName && member.searchText == old.searchText )
+    {
+        // Only the disambiguation in the displayed name may have changed
+        const int pos = find(shown(), member);
+        if( pos >= 0 && pos < m_loadedCount )
+            emit dataChanged(index(pos), index(pos), {Qt::DisplayRole} );
+        return;
+    }
+    removeMember(user);
+    insertMember(member);
 }
 
 void UserListModel::avatarChanged(QMatrixClient::User* user)
 {
-    int pos = m_users.indexOf(user);
-    if ( pos > -1 )
+    // Comes for users of all rooms
+    auto it = m_keys.find(user);
+    if( it == m_keys.end() )
+        return;
+    const int pos = find(shown(), it.value());
+    if( pos >= 0 && pos < m_loadedCount )
         emit dataChanged(index(pos), index(pos), {Qt::DecorationRole} );
 }
 
+void UserListModel::avatarReady(QUrl mxcUrl)
+{
+    // Only the rows that asked for it need repainting
+    for( QMatrixClient::User* user: m_pendingAvatars.take(mxcUrl) )
+    {
+        auto it = m_keys.find(user);
+        if( it == m_keys.end() )
+            continue;
+        const int pos = find(shown(), it.value());
+        if( pos >= 0 && pos < m_loadedCount )
+            emit dataChanged(index(pos), index(pos), {Qt::DecorationRole} );
+    }
+}
+
+void UserListModel::powerLevelsChanged()
+{
+    // Rare enough to simply start over
+    rebuild();
+}
+
+UserListModel::Member UserListModel::makeMember(QMatrixClient::User* user) const
+{
+    const QString name = user->name().isEmpty() ? user->id() : user->name();
+    return { user, m_currentRoom->powerLevel(user->id()),
+             name.toCaseFolded(), (name + ' ' + user->id()).toCaseFolded() };
+}
+
+bool UserListModel::matchesFilter(const Member& member) const
+{
+    return member.searchText.contains(m_filter);
+}
+
+void UserListModel::rebuild()
+{
+    beginResetModel();
+    m_members.clear();
+    m_matches.clear();
+    m_keys.clear();
+    m_addedUsers.clear();
+    m_pendingAvatars.clear();
+    if( m_currentRoom )
+    {
+        const QList<QMatrixClient::User*> users = m_currentRoom->users();
+        m_members.reserve(users.size());
+        m_keys.reserve(users.size());
+        for( QMatrixClient::User* user: users )
+        {
+            const Member member = makeMember(user);
+            m_members.append(member);
+            m_keys.insert(user, member);
+        }
+        std::sort(m_members.begin(), m_members.end());
+        if( !m_filter.isEmpty() )
+            for( const Member& member: m_members )
+                if( matchesFilter(member) )
+                    m_matches.append(member);
+    }
+    m_loadedCount = qMin(PageSize, shown().size());
+    endResetModel();
+}
+
+void UserListModel::insertMember(const Member& member)
+{
+    m_keys.insert(member.user, member);
+    m_members.insert(std::upper_bound(m_members.begin(), m_members.end(), member), member);
+    if( !m_filter.isEmpty() )
+    {
+        if( !matchesFilter(member) )
+            return;
+        m_matches.insert(std::upper_bound(m_matches.begin(), m_matches.end(), member), member);
+    }
+    // Rows past the loaded ones come with the next page
+    const int pos = find(shown(), member);
+    if( pos >= m_loadedCount && m_loadedCount < shown().size() - 1 )
+        return;
+    beginInsertRows(QModelIndex(), pos, pos);
+    ++m_loadedCount;
+    endInsertRows();
+}
+
+void UserListModel::removeMember(QMatrixClient::User* user)
+{
+    auto it = m_keys.find(user);
+    if( it == m_keys.end() )
+        return;
+    const Member member = it.value();
+    m_keys.erase(it);
+
+    const int shownPos = find(shown(), member);
+    const bool loaded = shownPos >= 0 && shownPos < m_loadedCount;
+    if( loaded )
+        beginRemoveRows(QModelIndex(), shownPos, shownPos);
+    const int pos = find(m_members, member);
+    if( pos >= 0 )
+        m_members.remove(pos);
+    if( !m_filter.isEmpty() )
+    {
+        const int matchPos = find(m_matches, member);
+        if( matchPos >= 0 )
+            m_matches.remove(matchPos);
+    }
+    if( loaded )
+    {
+        --m_loadedCount;
+        endRemoveRows();
+    }
+}
+
+int UserListModel::find(const QVector<Member>& list, const Member& member) const
+{
+    auto it = std::lower_bound(list.begin(), list.end(), member);
+    if( it == list.end() || it->user != member.user )
+        return -1;
+    return int(it - list.begin());
+}
+
+const QVector<UserListModel::Member>& UserListModel::shown() const
+{
+    return m_filter.isEmpty() ? m_members : m_matches;
+}
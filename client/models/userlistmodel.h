@@ -21,6 +21,10 @@
 #define USERLISTMODEL_H
 
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QUrl>
+#include <QtCore/QVector>
 
 namespace QMatrixClient
 {
@@ -29,6 +33,16 @@ namespace QMatrixClient
     class User;
 }
 
+class QuaternionRoom;
+class QTimer;
+
+/**
+ * The members of a room, ordered by power level and then by name, and
+ * optionally filtered by a search term. The order is kept up to date
+ * incrementally as members join, leave or are renamed. Rows are exposed
+ * to views page by page as they scroll (canFetchMore()/fetchMore()), so
+ * showing a room with tens of thousands of members is cheap.
+ */
 class UserListModel: public QAbstractListModel
 {
         Q_OBJECT
@@ -38,20 +52,66 @@ class UserListModel: public QAbstractListModel
 
         void setConnection(QMatrixClient::Connection* connection);
         void setRoom(QMatrixClient::Room* room);
+        /**
+         * Only shows members whose name or user id contains the term,
+         * ignoring case; an empty term shows everyone.
+         */
+        void setFilter(const QString& filter);
 
         QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
         int rowCount(const QModelIndex& parent=QModelIndex()) const override;
+        bool canFetchMore(const QModelIndex& parent) const override;
+        void fetchMore(const QModelIndex& parent) override;
 
     private slots:
         void userAdded(QMatrixClient::User* user);
         void userRemoved(QMatrixClient::User* user);
         void memberRenamed(QMatrixClient::User* user);
         void avatarChanged(QMatrixClient::User* user);
+        void avatarReady(QUrl mxcUrl);
+        void powerLevelsChanged();
+        void flushAddedUsers();
 
     private:
+        struct Member
+        {
+            QMatrixClient::User* user;
+            int powerLevel;
+            /** Case-folded display name, the secondary sort key */
+            QString sortName;
+            /** Case-folded display name and user id, for filtering */
+            QString searchText;
+
+            bool operator<(const Member& other) const;
+        };
+
+        Member makeMember(QMatrixClient::User* user) const;
+        bool matchesFilter(const Member& member) const;
+        /** Rebuilds the order and the filtered list from scratch */
+        void rebuild();
+        void insertMember(const Member& member);
+        void removeMember(QMatrixClient::User* user);
+        /** Returns the position of the member in the list, or -1 */
+        int find(const QVector<Member>& list, const Member& member) const;
+        /** Members shown, i.e. m_members or m_matches */
+        const QVector<Member>& shown() const;
+
         QMatrixClient::Connection* m_connection;
-        QMatrixClient::Room* m_currentRoom;
-        QList<QMatrixClient::User*> m_users;
+        QuaternionRoom* m_currentRoom;
+        QString m_filter;
+        /** All members, sorted */
+        QVector<Member> m_members;
+        /** Members matching m_filter, sorted */
+        QVector<Member> m_matches;
+        /** Members as they are in m_members, to find them again by key */
+        QHash<QMatrixClient::User*, Member> m_keys;
+        /** Users whose avatars were asked for but not there yet, by URL */
+        mutable QHash<QUrl, QSet<QMatrixClient::User*>> m_pendingAvatars;
+        /** The number of rows of shown() exposed to views so far */
+        int m_loadedCount;
+        /** Joined members not sorted in yet; added in batches */
+        QList<QMatrixClient::User*> m_addedUsers;
+        QTimer* m_flushTimer;
 };
 
 #endif // USERLISTMODEL_H
@@ -0,0 +1,156 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "paginationcontroller.h"
+
+#include <QtCore/QTimer>
+
+#include "quaternionroom.h"
+#include "message.h"
+
+namespace
+{
+    // Older messages are requested when the user would reach the top
+    // of the loaded content within this time at the current speed...
+    const qreal LookaheadTime = 2.0;
+    // ...or when less than this many screens are left above the viewport
+    const qreal MinBufferScreens = 2.0;
+    // Weight of the newest sample in the smoothed velocity
+    const qreal VelocitySmoothing = 0.3;
+    // The view is considered still if it hasn't moved for this long
+    const qint64 StillTime = 250;
+    const int RetryDelay = 5000;
+    // About a frame; the view lays out restored rows in the meantime
+    const int SettleDelay = 16;
+}
+
+PaginationController::PaginationController(QObject* parent)
+    : QObject(parent)
+    , m_room(nullptr)
+    , m_contentY(0)
+    , m_originY(0)
+    , m_height(0)
+    , m_firstRow(-1)
+    , m_lastRow(-1)
+    , m_velocity(0)
+    , m_evaluating(false)
+{
+    m_retryTimer = new QTimer(this);
+    m_retryTimer->setSingleShot(true);
+    m_retryTimer->setInterval(RetryDelay);
+    connect( m_retryTimer, &QTimer::timeout, this, &PaginationController::evaluate );
+    m_settleTimer = new QTimer(this);
+    m_settleTimer->setSingleShot(true);
+    m_settleTimer->setInterval(SettleDelay);
+    connect( m_settleTimer, &QTimer::timeout, this, &PaginationController::evaluate );
+}
+
+void PaginationController::setRoom(QuaternionRoom* room)
+{
+    if( m_room )
+        m_room->disconnect( this );
+    m_room = room;
+    m_velocity = 0;
+    m_firstRow = m_lastRow = -1;
+    m_retryTimer->stop();
+    m_settleTimer->stop();
+    if( m_room )
+        connect( m_room, &QuaternionRoom::paginationFinished,
+                 this, &PaginationController::paginationFinished );
+}
+
+void PaginationController::updateViewport(qreal contentY, qreal originY, qreal height,
+                                          int firstRow, int lastRow)
+{
+    // Rows inserted above the viewport move the origin, not contentY,
+    // so only actual scrolling counts towards the velocity.
+    if( m_lastUpdate.isValid() && m_lastUpdate.elapsed() > 0 )
+    {
+        const qreal sample = (m_contentY - contentY) * 1000 / m_lastUpdate.elapsed();
+        m_velocity = m_lastUpdate.elapsed() > StillTime ? sample
+                : VelocitySmoothing * sample + (1 - VelocitySmoothing) * m_velocity;
+    }
+    m_lastUpdate.start();
+    m_contentY = contentY;
+    m_originY = originY;
+    m_height = height;
+    m_firstRow = firstRow;
+    m_lastRow = lastRow;
+    if( m_room && firstRow >= 0 && firstRow < m_room->messages().size() )
+        m_room->setViewAnchor(m_room->messages().at(firstRow)->timestamp());
+    evaluate();
+}
+
+void PaginationController::paginationFinished(bool success)
+{
+    // Don't hammer the server if it fails; try again after a while
+    if( success )
+        evaluate();
+    else
+        m_retryTimer->start();
+}
+
+void PaginationController::evaluate()
+{
+    // Rows restored from memory report back through the view right away,
+    // with a geometry that is stale until the view lays them out; the
+    // next decision waits for that.
+    if( m_evaluating || m_settleTimer->isActive() )
+        return;
+    if( !m_room || m_room->isPaginating() || m_retryTimer->isActive() )
+        return;
+
+    m_evaluating = true;
+    const bool requested = requestMore();
+    m_evaluating = false;
+    // Only a restore from memory completes without paginating
+    if( requested && !m_room->isPaginating() )
+        m_settleTimer->start();
+}
+
+bool PaginationController::requestMore()
+{
+    // Gaps in view are filled first; from their newer side if they are
+    // in the upper half of the viewport, i.e. came into view from below.
+    const Timeline& messages = m_room->messages();
+    if( m_firstRow >= 0 && m_lastRow >= m_firstRow )
+    {
+        for( int row = m_firstRow; row <= m_lastRow && row < messages.size(); ++row )
+        {
+            // A gap with nothing to paginate from can't be filled
+            if( messages.at(row)->isGap() &&
+                    m_room->fillGap(messages.at(row),
+                                    2 * (row - m_firstRow) < m_lastRow - m_firstRow + 1) )
+                return true;
+        }
+    }
+
+    if( !m_room->canLoadPreviousContent() )
+        return false; // The start of the room is loaded
+
+    const qreal buffer = m_contentY - m_originY;
+    const qreal velocity = m_lastUpdate.isValid() && m_lastUpdate.elapsed() <= StillTime
+                           ? m_velocity : 0;
+    if( buffer < MinBufferScreens * m_height ||
+            (velocity > 0 && buffer / velocity < LookaheadTime) )
+    {
+        return m_room->loadPreviousContent();
+    }
+    return false;
+}
@@ -0,0 +1,76 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef PAGINATIONCONTROLLER_H
+#define PAGINATIONCONTROLLER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
+
+class QuaternionRoom;
+class QTimer;
+
+/**
+ * Decides when the timeline view needs more messages: older ones are
+ * requested ahead of time, based on how much content is left above the
+ * viewport and how fast the user scrolls towards it, and gaps are
+ * filled as they come into view. The room makes sure only one request
+ * is in flight at a time. Messages restored locally arrive at once, so
+ * the next decision waits for the view to lay them out.
+ */
+class PaginationController: public QObject
+{
+        Q_OBJECT
+    public:
+        PaginationController(QObject* parent = nullptr);
+
+        void setRoom(QuaternionRoom* room);
+
+        /**
+         * Called by the view whenever it scrolls or its content changes:
+         * contentY and originY as in Flickable, the viewport height and
+         * the first and last visible rows (-1 if unknown).
+         */
+        Q_INVOKABLE void updateViewport(qreal contentY, qreal originY, qreal height,
+                                        int firstRow, int lastRow);
+
+    private slots:
+        void paginationFinished(bool success);
+        void evaluate();
+
+    private:
+        /** Asks the room for more messages if needed; returns whether it did */
+        bool requestMore();
+
+        QuaternionRoom* m_room;
+        qreal m_contentY;
+        qreal m_originY;
+        qreal m_height;
+        int m_firstRow;
+        int m_lastRow;
+        /** Upwards scrolling speed in pixels per second, smoothed */
+        qreal m_velocity;
+        QElapsedTimer m_lastUpdate;
+        QTimer* m_retryTimer;
+        /** Runs while a local restore is being laid out by the view */
+        QTimer* m_settleTimer;
+        bool m_evaluating;
+};
+
+#endif // PAGINATIONCONTROLLER_H
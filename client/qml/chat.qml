@@ -4,118 +4,345 @@ import QtQuick.Controls 1.0
 Rectangle {
     id: root
 
-    signal getPreviousContent()
+    signal fillGap(int row, bool backwards)
+    signal loadAnimation(string mediaId)
+    signal animationReady(string mediaId, url file)
+
+    // Text colours by event type, looked up once per row; black otherwise
+    readonly property var eventColors: ({ "other": "darkgrey", "gap": "darkgrey",
+                                          "emote": "darkblue" })
+
+    // Called once the full file of an animated image is downloaded
+    function playAnimation(mediaId, file) {
+        animationReady(mediaId, file);
+    }
+
+    // The view of the room shown; views of recently shown rooms are kept
+    // around hidden, with their delegates and scroll position
+    property Item currentView: null
+
+    function createRoomView(model) {
+        return roomViewComponent.createObject(root, { "model": model });
+    }
+
+    function showRoomView(view) {
+        if( currentView )
+            currentView.hide();
+        currentView = view;
+        if( currentView )
+            currentView.show();
+    }
 
     function scrollToBottom() {
-        chatView.positionViewAtEnd();
+        if( currentView )
+            currentView.scrollToBottom();
+    }
+
+    function scrollToRow(row) {
+        if( currentView )
+            currentView.scrollToRow(row);
     }
 
-    ScrollView {
-    anchors.fill: parent
+    Component {
+        id: roomViewComponent
 
-        ListView {
-            id: chatView
+        ScrollView {
+            id: roomView
             anchors.fill: parent
-            //width: 200; height: 250
+            visible: false
 
-            model: messageModel
-            delegate: messageDelegate
-            flickableDirection: Flickable.VerticalFlick
-            pixelAligned: true
-            property bool wasAtEndY: true
+            property alias model: chatView.model
+            property bool shownBefore: false
+            // A view left at the end follows new messages while hidden
+            property bool wasAtEndOnHide: true
 
-            function aboutToBeInserted() {
-                wasAtEndY = atYEnd;
-                console.log("aboutToBeInserted! atYEnd=" + atYEnd);
+            function show() {
+                visible = true;
+                if( !shownBefore || wasAtEndOnHide )
+                    scrollToBottom();
+                shownBefore = true;
+                chatView.updateViewport();
             }
 
-            function rowsInserted() {
-                if( wasAtEndY )
-                {
-                    root.scrollToBottom();
-                } else  {
-                    console.log("was not at end, not scrolling");
-                }
+            function hide() {
+                wasAtEndOnHide = chatView.atYEnd;
+                visible = false;
             }
 
-            Component.onCompleted: {
-                console.log("onCompleted");
-                model.rowsAboutToBeInserted.connect(aboutToBeInserted);
-                model.rowsInserted.connect(rowsInserted);
-                //positionViewAtEnd();
+            function scrollToBottom() {
+                chatView.positionViewAtEnd();
             }
 
-            section {
-                property: "date"
-                labelPositioning: ViewSection.InlineLabels | ViewSection.NextLabelAtEnd
+            function scrollToRow(row) {
+                chatView.positionViewAtIndex(row, ListView.Center);
+            }
+
+            ListView {
+                id: chatView
+                anchors.fill: parent
+
+                delegate: messageDelegate
+                flickableDirection: Flickable.VerticalFlick
+                pixelAligned: true
+                // Delegates just outside the viewport are kept, and new ones
+                // are created ahead of time, so scrolling back and forth
+                // doesn't create them again
+                cacheBuffer: 1000
+                property bool wasAtEndY: true
 
-                delegate: Rectangle {
-                    width:parent.width
-                    height: childrenRect.height
-                    color: "lightgrey"
-                    Label { text: section.toLocaleString("dd.MM.yyyy") }
+                // Both are called once per inserted range of rows, not per row
+                function aboutToBeInserted() {
+                    wasAtEndY = atYEnd;
+                }
+
+                function rowsInserted() {
+                    if( wasAtEndY && roomView.visible )
+                        roomView.scrollToBottom();
                 }
-            }
 
-            onContentYChanged: {
-                if( (this.contentY - this.originY) < 5 )
-                {
-                    console.log("get older content!");
-                    root.getPreviousContent()
+                Component.onCompleted: {
+                    model.rowsAboutToBeInserted.connect(aboutToBeInserted);
+                    model.rowsInserted.connect(rowsInserted);
                 }
 
+                section {
+                    property: "date"
+                    labelPositioning: ViewSection.InlineLabels | ViewSection.NextLabelAtEnd
+
+                    delegate: Rectangle {
+                        width:parent.width
+                        // The gap before the oldest event has no date
+                        visible: section != ""
+                        height: visible ? childrenRect.height : 0
+                        color: "lightgrey"
+                        Label { text: section.toLocaleString("dd.MM.yyyy") }
+                    }
+                }
+
+                // Only the view shown drives pagination and prefetching
+                function updateViewport() {
+                    if( !roomView.visible )
+                        return;
+                    var firstRow = indexAt(0, contentY);
+                    var lastRow = indexAt(0, contentY + height - 1);
+                    pagination.updateViewport(contentY, originY, height, firstRow, lastRow);
+                    prefetcher.updateViewport(firstRow, lastRow);
+                }
+                onContentYChanged: updateViewport()
+                onOriginYChanged: updateViewport()
+                onHeightChanged: updateViewport()
+                onCountChanged: updateViewport()
+
+                // One MouseArea for all rows instead of one per delegate; it
+                // finds the row under the mouse and hands the event to it.
+                // Wheel events aren't handled here and reach the view.
+                MouseArea {
+                    parent: chatView
+                    anchors.fill: parent
+                    z: 1
+
+                    function rowAt(mouse) {
+                        return chatView.itemAt(mouse.x + chatView.contentX,
+                                               mouse.y + chatView.contentY);
+                    }
+                    function pointIn(row, mouse) {
+                        return mapToItem(row, mouse.x, mouse.y);
+                    }
+
+                    // An open editor takes the mouse itself, to select text
+                    onPressed: {
+                        var row = rowAt(mouse);
+                        mouse.accepted = !(row && row.editing);
+                    }
+                    onClicked: {
+                        var row = rowAt(mouse);
+                        if( row )
+                            row.click(pointIn(row, mouse));
+                    }
+                    onDoubleClicked: {
+                        var row = rowAt(mouse);
+                        if( row )
+                            row.openEditor(pointIn(row, mouse));
+                    }
+                    onPressAndHold: {
+                        var row = rowAt(mouse);
+                        if( row )
+                            row.openEditor(pointIn(row, mouse));
+                    }
+                }
             }
         }
     }
 
+    // Every row pays for what's created here, so anything only some
+    // rows need is loaded on demand.
     Component {
         id: messageDelegate
 
         Row {
             id: message
             width: parent.width
+            spacing: 3
+
+            property color textColor: root.eventColors[eventType] || "black"
+            readonly property bool editing: editor.active
+
+            // Mouse input comes from the view's MouseArea, in row coordinates
+            function click(point) {
+                if( eventType == "gap" )
+                    fillGap();
+                else if( animated && imageLoader.item
+                         && hits(imageLoader.item, point) )
+                    imageLoader.item.toggleAnimation();
+            }
+
+            function openEditor(point) {
+                if( hits(contentField, point) )
+                    editor.open(mapToItem(contentField, point.x, point.y));
+            }
+
+            function hits(item, point) {
+                var p = mapToItem(item, point.x, point.y);
+                return p.x >= 0 && p.y >= 0 && p.x < item.width && p.y < item.height;
+            }
+
+            // Gaps in view are filled automatically; clicking one retries
+            // right away, from the side the user is looking at.
+            function fillGap() {
+                var view = message.ListView.view;
+                var backwards = message.y - view.contentY < view.height / 2;
+                root.fillGap(index, backwards);
+            }
 
-            Label {
+            Text {
                 id: timelabel
-                text: time.toLocaleString(Qt.locale("de_DE"), "'<'hh:mm:ss'>'")
+                text: timeText
                 color: "grey"
             }
-            Label {
+            Text {
                 width: 120; elide: Text.ElideRight;
                 text: eventType == "message" || eventType == "image" ? author : "***"
-                horizontalAlignment: if( eventType == "other" || eventType == "emote" )
-                                     { Text.AlignRight }
-                color: if( eventType == "other" ) { "darkgrey" }
-                       else if( eventType == "emote" ) { "darkblue" }
-                       else { "black" }
-
+                horizontalAlignment: eventType == "other" || eventType == "emote"
+                                     ? Text.AlignRight : Text.AlignLeft
+                color: message.textColor
             }
             Rectangle {
                 color: highlight ? "orange" : "white"
-                height: contentField.height + imageField.height
-                width: parent.width - (x - parent.x) - spacing
-                TextEdit {
-                        id: contentField
-                        selectByMouse: true; readOnly: true; font: timelabel.font;
-                        text: content
-                        wrapMode: Text.Wrap; width: parent.width
-                        color: if( eventType == "other" ) { "darkgrey" }
-                               else if( eventType == "emote" ) { "darkblue" }
-                               else { "black" }
+                height: contentField.height + imageLoader.height
+                width: parent.width - (x - parent.x) - parent.spacing
+
+                Text {
+                    id: contentField
+                    text: eventType == "image" ? "" : content
+                    height: eventType == "image" ? 0 : implicitHeight
+                    textFormat: Text.PlainText
+                    wrapMode: Text.Wrap; width: parent.width
+                    color: message.textColor
+                    // The editor takes over while text is being selected
+                    visible: !editor.active
+                }
+                // A read-only editor to select text in, only while it has focus
+                Loader {
+                    id: editor
+                    anchors.fill: contentField
+                    active: false
+                    property point pressPoint
+
+                    // Opens with the word under the mouse selected
+                    function open(mouse) {
+                        if( eventType == "gap" )
+                            return;
+                        pressPoint = Qt.point(mouse.x, mouse.y);
+                        active = true;
+                    }
+
+                    sourceComponent: Component {
+                        TextEdit {
+                            text: contentField.text
+                            font: contentField.font
+                            wrapMode: contentField.wrapMode
+                            color: contentField.color
+                            selectByMouse: true; readOnly: true
+                            Component.onCompleted: {
+                                cursorPosition = positionAt(editor.pressPoint.x, editor.pressPoint.y);
+                                selectWord();
+                                forceActiveFocus();
+                            }
+                            onActiveFocusChanged: if( !activeFocus ) editor.active = false
+                        }
+                    }
+                }
+                Loader {
+                    anchors.fill: contentField
+                    active: debug
+                    sourceComponent: Component {
                         ToolTipArea {
                             tip { text: toolTip; color: "#999999"; zParent: message }
-                            enabled: debug
                         }
+                    }
                 }
-                Image {
-                    id: imageField
+                Loader {
+                    id: imageLoader
                     anchors.top: contentField.bottom
-                    sourceSize.width: eventType == "image" ? 500 : 0
-                    sourceSize.height: eventType == "image" ? 500 : 0
-                    source: eventType == "image" ? content : ""
+                    active: eventType == "image"
+                    sourceComponent: Component {
+                        Image {
+                            id: imageField
+                            width: imageSize.width
+                            height: imageSize.height
+                            fillMode: Image.PreserveAspectFit
+                            sourceSize: imageSize
+                            source: content
+                            // MediaCache keeps recent images, within the budget;
+                            // QML's own cache would hold them outside of it
+                            cache: false
+
+                            // Only a still of an animated image is loaded; the
+                            // animation plays from the full file on demand, and
+                            // its frames are decoded as they are shown.
+                            property string animationFile
+                            property string mediaId: content.toString().replace("image://mtx/", "")
+
+                            function toggleAnimation() {
+                                if( animationFile != "" )
+                                    animationFile = "";
+                                else
+                                    root.loadAnimation(mediaId);
+                            }
+
+                            // Only shows the cursor; clicks come from the view
+                            Loader {
+                                anchors.fill: parent
+                                active: animated
+                                sourceComponent: Component {
+                                    MouseArea {
+                                        acceptedButtons: Qt.NoButton
+                                        cursorShape: Qt.PointingHandCursor
+                                    }
+                                }
+                            }
+                            Connections {
+                                target: root
+                                onAnimationReady: {
+                                    if( mediaId == imageField.mediaId )
+                                        imageField.animationFile = file;
+                                }
+                            }
+                            Loader {
+                                anchors.fill: parent
+                                active: imageField.animationFile != ""
+                                sourceComponent: Component {
+                                    AnimatedImage {
+                                        source: imageField.animationFile
+                                        fillMode: Image.PreserveAspectFit
+                                        cache: false
+                                    }
+                                }
+                            }
+                        }
+                    }
                 }
             }
-            spacing: 3
         }
     }
 }
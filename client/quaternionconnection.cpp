@@ -19,13 +19,505 @@
 
 #include "quaternionconnection.h"
 #include "quaternionroom.h"
+#include "highlightmatcher.h"
+#include "message.h"
+#include "searchindex.h"
+#include "avatarcache.h"
+#include "mediacache.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSettings>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QUrlQuery>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+#include <QtNetwork/QNetworkRequest>
+
+#include "lib/connectiondata.h"
+#include "lib/room.h"
+#include "lib/user.h"
+#include "lib/events/event.h"
+#include "lib/events/roommessageevent.h"
+#include "lib/events/roommemberevent.h"
+#include "lib/jobs/syncjob.h"
+
+namespace
+{
+    // Bump this whenever the layout of the cache changes; older caches
+    // are then ignored and the next sync is a full one.
+    const int CacheVersion = 1;
+    // Number of the most recent timeline events saved for each room
+    const int CachedTimelineSize = 50;
+    const int SaveStateInterval = 5 * 60 * 1000;
+    // Same as the filter used by Connection::sync()
+    const QString SyncFilter { R"({"room": { "timeline": { "limit": 100 } } })" };
+
+    QJsonObject stateEvent(QString type, QString stateKey, QJsonObject content)
+    {
+        QJsonObject event;
+        event.insert("type", type);
+        event.insert("state_key", stateKey);
+        event.insert("content", content);
+        return event;
+    }
+
+    QJsonObject roomToJson(QMatrixClient::Room* room)
+    {
+        using namespace QMatrixClient;
+
+        // The room state is saved as a set of synthetic state events built
+        // from what the Room object knows; this way the cache is loaded
+        // through the same code path as a sync response.
+        QJsonArray stateEvents;
+        if( !room->name().isEmpty() )
+            stateEvents.append(stateEvent("m.room.name", "",
+                                          {{ "name", room->name() }}));
+        if( !room->canonicalAlias().isEmpty() )
+            stateEvents.append(stateEvent("m.room.canonical_alias", "",
+                                          {{ "alias", room->canonicalAlias() }}));
+        if( !room->aliases().isEmpty() )
+            stateEvents.append(stateEvent("m.room.aliases", "",
+                    {{ "aliases", QJsonArray::fromStringList(room->aliases()) }}));
+        if( !room->topic().isEmpty() )
+            stateEvents.append(stateEvent("m.room.topic", "",
+                                          {{ "topic", room->topic() }}));
+        const QJsonObject powerLevels = static_cast<QuaternionRoom*>(room)->powerLevels();
+        if( !powerLevels.isEmpty() )
+            stateEvents.append(stateEvent("m.room.power_levels", "", powerLevels));
+        for( User* user: room->users() )
+        {
+            QJsonObject memberContent;
+            memberContent.insert("membership", QString("join"));
+            memberContent.insert("displayname", user->name());
+            const QUrl avatarUrl =
+                static_cast<QuaternionRoom*>(room)->memberAvatarUrl(user->id());
+            if( !avatarUrl.isEmpty() )
+                memberContent.insert("avatar_url", avatarUrl.toString());
+            QJsonObject memberEvent = stateEvent("m.room.member", user->id(), memberContent);
+            memberEvent.insert("sender", user->id());
+            stateEvents.append(memberEvent);
+        }
+
+        QJsonObject roomJson;
+        if( room->joinState() == JoinState::Invite )
+        {
+            roomJson.insert("invite_state", QJsonObject {{ "events", stateEvents }});
+            return roomJson;
+        }
+        roomJson.insert("state", QJsonObject {{ "events", stateEvents }});
+
+        // Only events after the newest gap are contiguous; restoring
+        // older ones would hide the gap.
+        const QDateTime since = static_cast<QuaternionRoom*>(room)->contiguousSince();
+        QJsonArray timelineEvents;
+        const auto& events = room->messageEvents();
+        for( int i = qMax(0, events.size() - CachedTimelineSize); i < events.size(); ++i )
+        {
+            if( since.isValid() && events.at(i)->timestamp() <= since )
+                continue;
+            timelineEvents.append(
+                QJsonDocument::fromJson(events.at(i)->originalJson().toUtf8()).object());
+        }
+        QJsonObject timeline;
+        timeline.insert("events", timelineEvents);
+        // There's a gap between the restored timeline and whatever was
+        // before it on the server.
+        timeline.insert("limited", true);
+        roomJson.insert("timeline", timeline);
+
+        QJsonObject unreadNotifications;
+        unreadNotifications.insert("highlight_count", room->highlightCount());
+        unreadNotifications.insert("notification_count", room->notificationCount());
+        roomJson.insert("unread_notifications", unreadNotifications);
+        return roomJson;
+    }
+}
 
 QuaternionConnection::QuaternionConnection(QUrl server, QObject* parent)
     : QMatrixClient::Connection(server, parent)
+    , m_syncReply(nullptr)
+    , m_syncPending(false)
+    , m_pendingSyncTimeout(-1)
+    , m_searchIndex(nullptr)
+    , m_searchThread(nullptr)
+    , m_avatarCache(nullptr)
+    , m_mediaCache(nullptr)
+{
+    m_nam = new QNetworkAccessManager(this);
+    m_syncWatcher = new QFutureWatcher<SyncBatch>(this);
+    connect( m_syncWatcher, &QFutureWatcher<SyncBatch>::finished, this, &QuaternionConnection::syncParsed );
+    m_loadWatcher = new QFutureWatcher<SyncBatch>(this);
+    connect( m_loadWatcher, &QFutureWatcher<SyncBatch>::finished, this, &QuaternionConnection::stateLoaded );
+
+    m_highlightKeywords = QSettings().value("highlight/keywords").toStringList();
+
+    m_saveStateTimer = new QTimer(this);
+    m_saveStateTimer->setInterval(SaveStateInterval);
+    connect( m_saveStateTimer, &QTimer::timeout, this, &QuaternionConnection::saveState );
+}
+
+QuaternionConnection::~QuaternionConnection()
+{
+    stopSearchIndex();
+}
+
+void QuaternionConnection::loadState()
+{
+    // Save the state every now and then so that a crash doesn't cost
+    // a full initial sync on the next start.
+    m_saveStateTimer->start();
+
+    if( !m_searchIndex )
+    {
+        qRegisterMetaType<QVector<SearchDocument>>();
+        qRegisterMetaType<QVector<SearchHit>>();
+        m_searchThread = new QThread(this);
+        m_searchIndex = new SearchIndex(cacheDir() + "/search.idx");
+        m_searchIndex->moveToThread(m_searchThread);
+        connect( m_searchThread, &QThread::finished, m_searchIndex, &QObject::deleteLater );
+        // The application object outlives the connection, which is
+        // usually not deleted at all; save the index on the way out.
+        connect( qApp, &QCoreApplication::aboutToQuit, this, &QuaternionConnection::stopSearchIndex );
+        m_searchThread->start(QThread::LowPriority);
+        QMetaObject::invokeMethod(m_searchIndex, "load", Qt::QueuedConnection);
+    }
+
+    const QString path = stateCachePath();
+    const HighlightSnapshot snapshot = highlightSnapshot();
+    m_loadWatcher->setFuture(QtConcurrent::run([path, snapshot] {
+        QFile file { path };
+        if( !file.open(QFile::ReadOnly) )
+        {
+            qDebug() << "No state cache at" << path;
+            return SyncBatch();
+        }
+        const QJsonObject cache = QJsonDocument::fromBinaryData(file.readAll()).object();
+        if( cache.value("cache_version").toInt() != CacheVersion )
+        {
+            qDebug() << "Ignoring the state cache of an unsupported version";
+            return SyncBatch();
+        }
+        return SyncBatch::fromJson(cache, snapshot);
+    }));
+}
+
+void QuaternionConnection::stateLoaded()
+{
+    const SyncBatch batch = m_loadWatcher->result();
+    applyBatch(batch);
+    qDebug() << "Restored" << batch.rooms.size() << "room(s) from the state cache";
+
+    if( m_syncPending )
+    {
+        m_syncPending = false;
+        backgroundSync(m_pendingSyncTimeout);
+    }
+}
+
+void QuaternionConnection::saveState()
+{
+    using namespace QMatrixClient;
+
+    const QString nextBatch = connectionData()->lastEvent();
+    if( nextBatch.isEmpty() )
+        return; // Nothing has been synced yet
+
+    QJsonObject joinedRooms;
+    QJsonObject invitedRooms;
+    QJsonObject leftRooms;
+    for( Room* room: roomMap() )
+    {
+        switch( room->joinState() )
+        {
+            case JoinState::Join:
+                joinedRooms.insert(room->id(), roomToJson(room));
+                break;
+            case JoinState::Invite:
+                invitedRooms.insert(room->id(), roomToJson(room));
+                break;
+            case JoinState::Leave:
+                leftRooms.insert(room->id(), roomToJson(room));
+                break;
+        }
+    }
+    QJsonObject rooms;
+    rooms.insert("join", joinedRooms);
+    rooms.insert("invite", invitedRooms);
+    rooms.insert("leave", leftRooms);
+
+    QJsonObject cache;
+    cache.insert("cache_version", CacheVersion);
+    cache.insert("next_batch", nextBatch);
+    cache.insert("rooms", rooms);
+
+    const QString path = stateCachePath();
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file { path };
+    if( !file.open(QFile::WriteOnly) )
+    {
+        qWarning() << "Couldn't open" << path << "to save the state:" << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument(cache).toBinaryData());
+    if( !file.commit() )
+        qWarning() << "Couldn't save the state to" << path << ":" << file.errorString();
+
+    if( m_searchIndex )
+        QMetaObject::invokeMethod(m_searchIndex, "save", Qt::QueuedConnection);
+}
+
+void QuaternionConnection::backgroundSync(int timeout)
+{
+    if( m_loadWatcher->isRunning() )
+    {
+        m_syncPending = true;
+        m_pendingSyncTimeout = timeout;
+        return;
+    }
+    if( m_syncReply || m_syncWatcher->isRunning() )
+        return;
+
+    QUrlQuery query;
+    query.addQueryItem("filter", SyncFilter);
+    const QString since = connectionData()->lastEvent();
+    if( !since.isEmpty() )
+        query.addQueryItem("since", since);
+    if( timeout >= 0 )
+        query.addQueryItem("timeout", QString::number(timeout));
+
+    m_syncReply = apiGet("/sync", query);
+    connect( m_syncReply, &QNetworkReply::finished, this, &QuaternionConnection::syncReplyFinished );
+}
+
+QNetworkReply* QuaternionConnection::apiGet(const QString& path, QUrlQuery query)
+{
+    return m_nam->get(QNetworkRequest(apiUrl("/_matrix/client/r0" + path, query)));
+}
+
+QNetworkReply* QuaternionConnection::mediaGet(const QString& path, QUrlQuery query)
+{
+    return m_nam->get(QNetworkRequest(apiUrl("/_matrix/media/r0" + path, query)));
+}
+
+QNetworkReply* QuaternionConnection::apiPost(const QString& path, const QJsonObject& body,
+                                             QUrlQuery query)
+{
+    QNetworkRequest request(apiUrl("/_matrix/client/r0" + path, query));
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+    return m_nam->post(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
+}
+
+QUrl QuaternionConnection::apiUrl(const QString& path, QUrlQuery query)
 {
+    QUrl url = homeserver();
+    url.setPath(url.path() + path, QUrl::TolerantMode);
+    query.addQueryItem("access_token", token());
+    url.setQuery(query);
+    return url;
+}
+
+void QuaternionConnection::syncReplyFinished()
+{
+    QNetworkReply* reply = m_syncReply;
+    m_syncReply = nullptr;
+    reply->deleteLater();
+    if( reply->error() != QNetworkReply::NoError )
+    {
+        emit connectionError(reply->errorString());
+        return;
+    }
+
+    const QByteArray payload = reply->readAll();
+    const HighlightSnapshot snapshot = highlightSnapshot();
+    m_syncWatcher->setFuture(QtConcurrent::run([payload, snapshot] {
+        return SyncBatch::fromPayload(payload, snapshot);
+    }));
+}
+
+void QuaternionConnection::syncParsed()
+{
+    const SyncBatch batch = m_syncWatcher->result();
+    if( !batch.error.isEmpty() )
+    {
+        emit connectionError(batch.error);
+        return;
+    }
+    applyBatch(batch);
+    emit syncDone();
+}
+
+void QuaternionConnection::applyBatch(const SyncBatch& batch)
+{
+    using namespace QMatrixClient;
+
+    for( const SyncBatch::Room& roomBatch: batch.rooms )
+    {
+        // Room::updateData() wants a non-const reference; events are
+        // held by pointers so the copy is cheap.
+        SyncRoomData data = roomBatch.data;
+        Room* room = provideRoom(data.roomId);
+        if( !room )
+        {
+            // Nobody takes the events the worker parsed
+            qDeleteAll(roomBatch.messages);
+            qDeleteAll(data.state);
+            qDeleteAll(data.timeline);
+            continue;
+        }
+        QuaternionRoom* qRoom = static_cast<QuaternionRoom*>(room);
+        for( const auto& events: { data.state, data.timeline } )
+        {
+            for( Event* event: events )
+            {
+                if( event->type() != EventType::RoomMember )
+                    continue;
+                RoomMemberEvent* e = static_cast<RoomMemberEvent*>(event);
+                // Other memberships don't carry the member's profile
+                if( e->membership() != MembershipType::Join )
+                {
+                    if( e->membership() == MembershipType::Leave ||
+                            e->membership() == MembershipType::Ban )
+                        qRoom->forgetMemberAvatarUrl(e->userId());
+                    continue;
+                }
+                // The newest join anywhere is the fallback for rooms
+                // that haven't seen the member
+                m_avatarUrls.insert(e->userId(), e->avatarUrl());
+                if( qRoom->setMemberAvatarUrl(e->userId(), e->avatarUrl()) )
+                    emit userAvatarChanged(user(e->userId()));
+            }
+        }
+        if( roomBatch.limited && !data.timeline.isEmpty() )
+            qRoom->addSyncGap(roomBatch.prevBatch, connectionData()->lastEvent());
+        qRoom->addPreparedMessages(roomBatch.messages);
+        room->updateData(data);
+        if( !roomBatch.powerLevels.isEmpty() )
+            qRoom->setPowerLevels(roomBatch.powerLevels);
+        qRoom->discardPreparedMessages();
+        qRoom->flushNewMessages();
+    }
+    if( !batch.nextBatch.isEmpty() )
+        connectionData()->setLastEvent(batch.nextBatch);
+}
+
+HighlightSnapshot QuaternionConnection::highlightSnapshot()
+{
+    HighlightSnapshot snapshot;
+    snapshot.localUserId = userId();
+    // Summary-only rooms don't build messages, nor need a matcher
+    for( QMatrixClient::Room* room: roomMap() )
+    {
+        QuaternionRoom* qRoom = static_cast<QuaternionRoom*>(room);
+        if( !qRoom->isSummaryOnly() )
+            snapshot.matchers.insert(room->id(), qRoom->highlightMatcher());
+    }
+    return snapshot;
+}
+
+QStringList QuaternionConnection::highlightKeywords() const
+{
+    return m_highlightKeywords;
+}
+
+void QuaternionConnection::setHighlightKeywords(const QStringList& keywords)
+{
+    if( keywords == m_highlightKeywords )
+        return;
+    m_highlightKeywords = keywords;
+    QSettings().setValue("highlight/keywords", keywords);
+    for( QMatrixClient::Room* room: roomMap() )
+        static_cast<QuaternionRoom*>(room)->refreshHighlights();
+}
+
+SearchIndex* QuaternionConnection::searchIndex() const
+{
+    return m_searchIndex;
+}
+
+void QuaternionConnection::stopSearchIndex()
+{
+    if( !m_searchThread || !m_searchThread->isRunning() )
+        return;
+    QMetaObject::invokeMethod(m_searchIndex, "save", Qt::BlockingQueuedConnection);
+    m_searchThread->quit();
+    m_searchThread->wait();
+}
+
+void QuaternionConnection::indexEvents(QuaternionRoom* room, const QList<QMatrixClient::Event*>& events)
+{
+    using namespace QMatrixClient;
+
+    if( !m_searchIndex )
+        return;
+
+    QVector<SearchDocument> documents;
+    for( Event* event: events )
+    {
+        if( event->type() != EventType::RoomMessage )
+            continue;
+        RoomMessageEvent* e = static_cast<RoomMessageEvent*>(event);
+        if( e->msgtype() == MessageEventType::Image )
+            continue;
+        documents.append({ room->id(), e->id(), e->timestamp(), e->body() });
+    }
+    if( !documents.isEmpty() )
+        QMetaObject::invokeMethod(m_searchIndex, "addDocuments", Qt::QueuedConnection,
+                                  Q_ARG(QVector<SearchDocument>, documents));
+}
+
+QUrl QuaternionConnection::avatarUrl(const QString& userId) const
+{
+    return m_avatarUrls.value(userId);
+}
+
+AvatarCache* QuaternionConnection::avatarCache()
+{
+    if( !m_avatarCache )
+        m_avatarCache = new AvatarCache(this, this);
+    return m_avatarCache;
+}
+
+MediaCache* QuaternionConnection::mediaCache()
+{
+    if( !m_mediaCache )
+    {
+        m_mediaCache = new MediaCache(this, cacheDir() + "/media", this);
+        connect( qApp, &QCoreApplication::aboutToQuit, m_mediaCache, &MediaCache::saveIndex );
+    }
+    return m_mediaCache;
+}
+
+void QuaternionConnection::watchUser(QMatrixClient::User* user)
+{
+    connect( user, &QMatrixClient::User::avatarChanged,
+             this, &QuaternionConnection::userAvatarChanged, Qt::UniqueConnection );
 }
 
 QMatrixClient::Room* QuaternionConnection::createRoom(QString roomId)
 {
     return new QuaternionRoom(this, roomId);
 }
+
+QString QuaternionConnection::cacheDir()
+{
+    QString userDir = userId();
+    userDir.replace(':', '_').replace('/', '_');
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + '/' + userDir;
+}
+
+QString QuaternionConnection::stateCachePath()
+{
+    return cacheDir() + "/state.bin";
+}
@@ -21,15 +21,143 @@
 #define QUATERNIONCONNECTION_H
 
 #include "lib/connection.h"
+#include "syncbatch.h"
+
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QHash>
+#include <QtCore/QUrlQuery>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class QThread;
+class QTimer;
+class Message;
+class QuaternionRoom;
+class SearchIndex;
+class AvatarCache;
+class MediaCache;
 
 class QuaternionConnection: public QMatrixClient::Connection
 {
         Q_OBJECT
     public:
         QuaternionConnection(QUrl server, QObject* parent = nullptr);
+        virtual ~QuaternionConnection();
+
+        /**
+         * Restores the rooms, their state, recent timeline and the sync
+         * token saved by a previous session. Call it after connecting
+         * and before the first sync so that the sync is incremental.
+         * The cache is read and parsed on a worker thread; a sync
+         * requested in the meantime starts once the state is restored.
+         * Also starts the search index.
+         */
+        void loadState();
+        /**
+         * Saves the same data to the local cache; on the next start
+         * loadState() picks it up.
+         */
+        void saveState();
+
+        /**
+         * Does the same as Connection::sync() but parses the response
+         * and builds messages on a worker thread; the GUI thread only
+         * splices finished per-room batches into the rooms. Emits
+         * syncDone() or connectionError() just like Connection::sync().
+         */
+        void backgroundSync(int timeout = -1);
+
+        /**
+         * Starts an authenticated GET request to a client-server API
+         * endpoint, e.g. "/rooms/<id>/messages"; parts of the path must
+         * be percent-encoded. The caller owns the reply.
+         */
+        QNetworkReply* apiGet(const QString& path, QUrlQuery query);
+        /** Same for a POST request with a JSON body */
+        QNetworkReply* apiPost(const QString& path, const QJsonObject& body,
+                               QUrlQuery query = QUrlQuery());
+        /**
+         * Same as apiGet() for a media repository endpoint, e.g.
+         * "/download/<server>/<id>"
+         */
+        QNetworkReply* mediaGet(const QString& path, QUrlQuery query);
+
+        /**
+         * Words that highlight a message in any room, in addition to
+         * the user id and own display name; stored in the settings.
+         */
+        QStringList highlightKeywords() const;
+        void setHighlightKeywords(const QStringList& keywords);
+
+        /**
+         * The full-text index of messages in all rooms, or nullptr before
+         * loadState(). It lives in its own thread, so invoke its slots
+         * through queued connections.
+         */
+        SearchIndex* searchIndex() const;
+        /** Adds message events of the room to the search index */
+        void indexEvents(QuaternionRoom* room, const QList<QMatrixClient::Event*>& events);
+        /**
+         * Starts forwarding the user's changes to userAvatarChanged();
+         * called by the rooms for each of their members. Watching a
+         * user twice has no effect.
+         */
+        void watchUser(QMatrixClient::User* user);
+
+        /**
+         * The avatar of the user as of the latest join event seen in any
+         * room; empty if there's none. Rooms may have their own, see
+         * QuaternionRoom::memberAvatarUrl().
+         */
+        QUrl avatarUrl(const QString& userId) const;
+        /** Scaled avatars shared by all views; created on first use */
+        AvatarCache* avatarCache();
+        /** Thumbnails and full media shared by all views; created on first use */
+        MediaCache* mediaCache();
+
+    signals:
+        /**
+         * Emitted by the rooms when their name, counts or last activity
+         * change, as a combination of QuaternionRoom::SummaryChange flags;
+         * lets views over all rooms track them with a single connection.
+         */
+        void roomSummaryChanged(QuaternionRoom* room, int changes);
+        /**
+         * Emitted when the avatar of any member of any room changes;
+         * member lists connect to this once instead of to every user.
+         */
+        void userAvatarChanged(QMatrixClient::User* user);
 
     protected:
         virtual QMatrixClient::Room* createRoom(QString roomId);
+
+    private slots:
+        void syncReplyFinished();
+        void syncParsed();
+        void stateLoaded();
+        void stopSearchIndex();
+
+    private:
+        /** The path includes the API prefix, e.g. "/_matrix/client/r0" */
+        QUrl apiUrl(const QString& path, QUrlQuery query);
+        QString stateCachePath();
+        QString cacheDir();
+        HighlightSnapshot highlightSnapshot();
+        void applyBatch(const SyncBatch& batch);
+
+        QNetworkAccessManager* m_nam;
+        QNetworkReply* m_syncReply;
+        QFutureWatcher<SyncBatch>* m_syncWatcher;
+        QFutureWatcher<SyncBatch>* m_loadWatcher;
+        bool m_syncPending;
+        int m_pendingSyncTimeout;
+        QTimer* m_saveStateTimer;
+        QStringList m_highlightKeywords;
+        SearchIndex* m_searchIndex;
+        QThread* m_searchThread;
+        QHash<QString, QUrl> m_avatarUrls;
+        AvatarCache* m_avatarCache;
+        MediaCache* m_mediaCache;
 };
 
 #endif // QUATERNIONCONNECTION_H
@@ -20,18 +20,97 @@
 #include "quaternionroom.h"
 
 #include "message.h"
+#include "highlightmatcher.h"
+#include "quaternionconnection.h"
 #include "lib/events/event.h"
 #include "lib/connection.h"
+#include "lib/user.h"
 
 #include <QtCore/QDebug>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QSet>
+#include <QtCore/QSettings>
+#include <QtCore/QTimer>
+#include <QtCore/QUrlQuery>
+#include <QtCore/QVector>
+#include <QtNetwork/QNetworkReply>
+
+#include <algorithm>
+
+namespace
+{
+    // The number of messages kept for a room that is not shown; can be
+    // changed with the "timeline/window_size" setting.
+    int timelineWindowSize()
+    {
+        static const int size = QSettings().value("timeline/window_size", 500).toInt();
+        return size;
+    }
+
+    // Rows kept above the first one the view shows when trimming a
+    // shown room, so that scrolling up a little doesn't restore them
+    int anchorMargin()
+    {
+        return timelineWindowSize() / 2;
+    }
+
+    // How many windows a room with a hidden view may keep for the view
+    // to stay where it was left
+    const int WarmWindowFactor = 2;
+
+    // The number of evicted messages re-created at once
+    const int RestorePageSize = 50;
+    // The number of events requested from the server at once
+    const int FetchPageSize = 50;
+    // The number of events loaded on each side of a jump target
+    const int ContextSize = 20;
+
+    bool earlier(const Message* a, const Message* b)
+    {
+        return a->timestamp() < b->timestamp();
+    }
+
+    QDateTime eventTimestamp(const QJsonObject& event)
+    {
+        return QDateTime::fromMSecsSinceEpoch(
+            qint64(event.value("origin_server_ts").toDouble()));
+    }
+
+    QJsonObject replyJson(QNetworkReply* reply)
+    {
+        if( reply->error() != QNetworkReply::NoError )
+        {
+            qDebug() << "Request to" << reply->url().path() << "failed:" << reply->errorString();
+            return QJsonObject();
+        }
+        return QJsonDocument::fromJson(reply->readAll()).object();
+    }
+}
 
 QuaternionRoom::QuaternionRoom(QMatrixClient::Connection* connection, QString roomId)
     : QMatrixClient::Room(connection, roomId)
 {
     m_shown = false;
+    m_keptWarm = false;
+    m_summaryOnly = true;
     m_unreadMessages = false;
-    connect( this, &QuaternionRoom::notificationCountChanged, this, &QuaternionRoom::countChanged );
-    connect( this, &QuaternionRoom::highlightCountChanged, this, &QuaternionRoom::countChanged );
+    m_pendingReadMarker = nullptr;
+    m_historyGap = nullptr;
+    m_usersDefaultPowerLevel = 0;
+    connect( this, &QuaternionRoom::notificationCountChanged, this, [this] {
+        countChanged(UnreadChange);
+    });
+    connect( this, &QuaternionRoom::highlightCountChanged, this, [this] {
+        countChanged(HighlightChange);
+    });
+    connect( this, &QMatrixClient::Room::displaynameChanged, this, &QuaternionRoom::nameChanged );
+    connect( this, &QMatrixClient::Room::joinStateChanged, this, [this] {
+        summaryChanged(JoinStateChange);
+    });
+    connect( this, &QMatrixClient::Room::memberRenamed, this, &QuaternionRoom::processMemberRename );
+    connect( this, &QMatrixClient::Room::userAdded,
+             static_cast<QuaternionConnection*>(connection), &QuaternionConnection::watchUser );
 }
 
 void QuaternionRoom::setShown(bool shown)
@@ -43,15 +122,20 @@ void QuaternionRoom::setShown(bool shown)
     {
         if( !messageEvents().empty() )
             markMessageAsRead( messageEvents().last() );
-        m_unreadMessages = false;
-        emit unreadMessagesChanged(this);
+        setUnreadMessages(false);
         qDebug() << displayName() << "no unread messages";
     }
     if( m_shown )
     {
+        materialize();
         resetHighlightCount();
         resetNotificationCount();
     }
+    else
+    {
+        // Let the views switch away from the room before trimming it
+        QTimer::singleShot(0, this, SLOT(trimTimeline()));
+    }
 }
 
 bool QuaternionRoom::isShown()
@@ -59,7 +143,48 @@ bool QuaternionRoom::isShown()
     return m_shown;
 }
 
-QList<Message*> QuaternionRoom::messages() const
+void QuaternionRoom::setKeptWarm(bool warm)
+{
+    if( warm == m_keptWarm )
+        return;
+    m_keptWarm = warm;
+    if( !m_keptWarm )
+    {
+        // The view is gone; a new one starts at the bottom
+        m_viewAnchor = QDateTime();
+        QTimer::singleShot(0, this, SLOT(trimTimeline()));
+    }
+}
+
+void QuaternionRoom::setViewAnchor(const QDateTime& timestamp)
+{
+    m_viewAnchor = timestamp;
+}
+
+bool QuaternionRoom::isSummaryOnly() const
+{
+    return m_summaryOnly;
+}
+
+void QuaternionRoom::materialize()
+{
+    if( !m_summaryOnly )
+        return;
+    m_summaryOnly = false;
+    // Gaps recorded so far come in along with the messages around them,
+    // except those in a room without messages yet
+    restoreEvictedMessages(timelineWindowSize());
+    for( Message* gap: QList<Message*>(m_gaps) )
+    {
+        if( m_messages.indexOf(gap) < 0 && isMaterialized(gap->timestamp()) )
+        {
+            m_gaps.removeOne(gap);
+            insertGap(gap);
+        }
+    }
+}
+
+const Timeline& QuaternionRoom::messages() const
 {
     return m_messages;
 }
@@ -69,30 +194,685 @@ bool QuaternionRoom::hasUnreadMessages()
     return m_unreadMessages;
 }
 
+QDateTime QuaternionRoom::lastActivity() const
+{
+    return messageEvents().isEmpty() ? QDateTime() : messageEvents().last()->timestamp();
+}
+
+int QuaternionRoom::powerLevel(const QString& userId) const
+{
+    return m_userPowerLevels.value(userId, m_usersDefaultPowerLevel);
+}
+
+QJsonObject QuaternionRoom::powerLevels() const
+{
+    return m_powerLevels;
+}
+
+void QuaternionRoom::setPowerLevels(const QJsonObject& content)
+{
+    if( content == m_powerLevels )
+        return;
+    m_powerLevels = content;
+    m_usersDefaultPowerLevel = content.value("users_default").toInt();
+    m_userPowerLevels.clear();
+    const QJsonObject users = content.value("users").toObject();
+    for( auto it = users.begin(); it != users.end(); ++it )
+        m_userPowerLevels.insert(it.key(), it.value().toInt());
+    emit powerLevelsChanged();
+}
+
+QUrl QuaternionRoom::memberAvatarUrl(const QString& userId) const
+{
+    auto it = m_memberAvatarUrls.find(userId);
+    if( it != m_memberAvatarUrls.end() )
+        return it.value();
+    return static_cast<QuaternionConnection*>(connection())->avatarUrl(userId);
+}
+
+bool QuaternionRoom::setMemberAvatarUrl(const QString& userId, const QUrl& url)
+{
+    auto it = m_memberAvatarUrls.find(userId);
+    if( it != m_memberAvatarUrls.end() && it.value() == url )
+        return false;
+    m_memberAvatarUrls.insert(userId, url);
+    return true;
+}
+
+void QuaternionRoom::forgetMemberAvatarUrl(const QString& userId)
+{
+    m_memberAvatarUrls.remove(userId);
+}
+
+int QuaternionRoom::memberGeneration(const QString& userId) const
+{
+    return m_memberGenerations.value(userId, 0);
+}
+
+void QuaternionRoom::processMemberRename(QMatrixClient::User* user)
+{
+    ++m_memberGenerations[user->id()];
+    if( user == connection()->user() )
+        refreshHighlights();
+}
+
+QSharedPointer<const HighlightMatcher> QuaternionRoom::highlightMatcher()
+{
+    const QString ownDisplayname = roomMembername(connection()->user());
+    if( !m_highlightMatcher || ownDisplayname != m_highlightDisplayname )
+    {
+        QStringList keywords =
+            static_cast<QuaternionConnection*>(connection())->highlightKeywords();
+        keywords << connection()->userId() << ownDisplayname;
+        m_highlightMatcher.reset(new HighlightMatcher(keywords));
+        m_highlightDisplayname = ownDisplayname;
+    }
+    return m_highlightMatcher;
+}
+
+void QuaternionRoom::refreshHighlights()
+{
+    QSet<QString> oldKeywords;
+    if( m_highlightMatcher )
+        for( const QString& keyword: m_highlightMatcher->keywords() )
+            oldKeywords.insert(keyword.toCaseFolded());
+    m_highlightMatcher.reset();
+    QSharedPointer<const HighlightMatcher> matcher = highlightMatcher();
+    QSet<QString> newKeywords;
+    for( const QString& keyword: matcher->keywords() )
+        newKeywords.insert(keyword.toCaseFolded());
+
+    const QSet<QString> added = QSet<QString>(newKeywords).subtract(oldKeywords);
+    const QSet<QString> removed = QSet<QString>(oldKeywords).subtract(newKeywords);
+    if( added.isEmpty() && removed.isEmpty() )
+        return;
+
+    // Messages not highlighted so far can only become highlighted by one
+    // of the added keywords, so scanning for those is enough.
+    const HighlightMatcher addedMatcher(added.toList());
+    const QString localUserId = connection()->userId();
+    QList<Message*> changed;
+    for( int i = 0; i < m_messages.size(); ++i )
+    {
+        Message* message = m_messages.at(i);
+        if( message->highlight() )
+        {
+            if( !removed.isEmpty() && message->updateHighlight(*matcher, localUserId) )
+                changed.append(message);
+        }
+        else if( !added.isEmpty() && message->updateHighlight(addedMatcher, localUserId) )
+            changed.append(message);
+    }
+    if( !changed.isEmpty() )
+        emit highlightsChanged(changed);
+}
+
+void QuaternionRoom::addPreparedMessages(const QHash<QMatrixClient::Event*, Message*>& messages)
+{
+    for( auto it = messages.begin(); it != messages.end(); ++it )
+        m_preparedMessages.insert(it.key(), it.value());
+}
+
+void QuaternionRoom::discardPreparedMessages()
+{
+    qDeleteAll(m_preparedMessages);
+    m_preparedMessages.clear();
+}
+
+bool QuaternionRoom::loadPreviousContent()
+{
+    materialize();
+    if( restoreEvictedMessages(RestorePageSize) > 0 )
+        return true;
+    return m_historyGap && fillGap(m_historyGap, true);
+}
+
+bool QuaternionRoom::loadMessagesSince(const QDateTime& timestamp)
+{
+    materialize();
+    while( m_messages.isEmpty() || m_messages.first()->timestamp() > timestamp )
+    {
+        if( restoreEvictedMessages(RestorePageSize) == 0 )
+            return false;
+    }
+    return true;
+}
+
+int QuaternionRoom::restoreEvictedMessages(int count)
+{
+    using namespace QMatrixClient;
+
+    // Evicted messages are those for events older than the first message
+    const auto& events = messageEvents();
+    auto end = events.end();
+    if( Message* firstLoaded = firstLoadedMessage() )
+    {
+        Event* first = firstLoaded->messageEvent();
+        end = std::lower_bound(events.begin(), events.end(), first,
+            [](Event* a, Event* b) { return a->timestamp() < b->timestamp(); });
+        while( end != events.end() && *end != first )
+            ++end;
+    }
+    auto begin = end - std::min<int>(count, end - events.begin());
+    if( begin == end )
+        return 0;
+
+    QList<Message*> messages;
+    for( auto it = begin; it != end; ++it )
+        messages.append(new Message(connection(), *it, this));
+    // Gaps evicted along with the messages come back with them; a gap
+    // goes after messages with the same timestamp, hence the stable sort.
+    QList<Message*> restored = messages;
+    for( Message* gap: m_gaps )
+    {
+        if( m_messages.indexOf(gap) < 0 &&
+                (begin == events.begin() || !(gap->timestamp() < (*begin)->timestamp())) )
+            restored.append(gap);
+    }
+    std::stable_sort(restored.begin(), restored.end(), earlier);
+
+    emit messagesAboutToBeInserted(0, restored.size() - 1);
+    for( int i = restored.size() - 1; i >= 0; --i )
+        m_messages.prepend(restored.at(i));
+    emit messagesInserted();
+    return messages.size();
+}
+
+void QuaternionRoom::trimTimeline()
+{
+    const int window = timelineWindowSize();
+    int evictCount = m_messages.size() - window;
+    // A hidden view beyond its own bound loses its place rather than
+    // keeping the room growing
+    const bool anchored = m_shown ||
+            (m_keptWarm && m_messages.size() <= WarmWindowFactor * window);
+    if( anchored )
+    {
+        // Only rows well above the view go
+        const int anchorRow =
+            m_viewAnchor.isValid() ? m_messages.lowerBound(m_viewAnchor) : 0;
+        evictCount = qMin(evictCount, anchorRow - anchorMargin());
+    }
+    if( evictCount <= 0 )
+        return;
+
+    emit messagesAboutToBeRemoved(0, evictCount - 1);
+    // Gaps stay in m_gaps until the messages around them are restored
+    for( Message* message: m_messages.takeFirst(evictCount) )
+        if( !message->isGap() )
+            delete message;
+    emit messagesRemoved();
+}
+
 void QuaternionRoom::processMessageEvent(QMatrixClient::Event* event)
 {
     bool isNewest = messageEvents().empty() || event->timestamp() > messageEvents().last()->timestamp();
     QMatrixClient::Room::processMessageEvent(event);
 
-    Message* message = new Message(connection(), event, this);
-    m_messages.insert(QMatrixClient::findInsertionPos(m_messages, message), message);
-
-    emit newMessage(message);
+    m_eventIds.insert(event->id());
+    if( m_pendingEvents.isEmpty() )
+        QTimer::singleShot(0, this, SLOT(flushNewMessages()));
+    m_pendingEvents.append(event);
+    Message* message = m_preparedMessages.take(event);
+    if( m_summaryOnly )
+        delete message;
+    else
+        m_pendingMessages.append(message ? message : new Message(connection(), event, this));
 
     if( !isNewest )
         return;
     if( m_shown )
     {
-        markMessageAsRead(event);
+        // Only the newest message of the batch gets a read receipt
+        m_pendingReadMarker = event;
     }
     else if( !m_unreadMessages )
     {
-        m_unreadMessages = true;
-        emit unreadMessagesChanged(this);
+        setUnreadMessages(true);
         qDebug() << "Room" << displayName() << ": unread messages";
     }
 }
 
+void QuaternionRoom::flushNewMessages()
+{
+    if( m_pendingEvents.isEmpty() )
+        return;
+
+    QList<QMatrixClient::Event*> events;
+    events.swap(m_pendingEvents);
+    auto qConnection = static_cast<QuaternionConnection*>(connection());
+    qConnection->indexEvents(this, events);
+    summaryChanged(ActivityChange);
+
+    QList<Message*> messages;
+    messages.swap(m_pendingMessages);
+    if( !messages.isEmpty() )
+    {
+        std::stable_sort(messages.begin(), messages.end(),
+            [](Message* a, Message* b) { return a->timestamp() < b->timestamp(); });
+        insertMessages(messages);
+        trimTimeline();
+    }
+
+    if( m_pendingReadMarker )
+    {
+        if( m_shown )
+            markMessageAsRead(m_pendingReadMarker);
+        m_pendingReadMarker = nullptr;
+    }
+}
+
+void QuaternionRoom::insertMessages(const QList<Message*>& messages)
+{
+    // Find where each message goes before inserting anything; the batch
+    // is sorted so the positions don't decrease and equal positions make
+    // up a contiguous range of new rows.
+    QVector<int> positions;
+    positions.reserve(messages.size());
+    for( Message* message: messages )
+        positions.append(m_messages.insertionPos(message));
+
+    int inserted = 0;
+    int i = 0;
+    while( i < messages.size() )
+    {
+        int end = i + 1;
+        while( end < messages.size() && positions.at(end) == positions.at(i) )
+            ++end;
+
+        const int first = positions.at(i) + inserted;
+        emit messagesAboutToBeInserted(first, first + end - i - 1);
+        for( int j = i; j < end; ++j )
+            m_messages.insert(messages.at(j));
+        emit messagesInserted();
+        inserted += end - i;
+        i = end;
+    }
+}
+
+void QuaternionRoom::addSyncGap(const QString& prevBatch, const QString& since)
+{
+    flushNewMessages();
+
+    Message* gap;
+    if( messageEvents().isEmpty() )
+    {
+        if( m_historyGap )
+            return;
+        // Ordered before any event there is
+        gap = new Message(QDateTime::fromMSecsSinceEpoch(0));
+        m_historyGap = gap;
+    }
+    else
+    {
+        gap = new Message(messageEvents().last()->timestamp());
+        gap->gap()->forwardToken = since;
+    }
+    gap->gap()->backToken = prevBatch;
+    insertGap(gap);
+}
+
+bool QuaternionRoom::fillGap(Message* gap, bool backwards)
+{
+    materialize();
+    if( !gap || !m_gaps.contains(gap) || isPaginating() )
+        return false;
+
+    Message::Gap* g = gap->gap();
+    if( (backwards ? g->backToken : g->forwardToken).isEmpty() && !gapEdge(gap, backwards) )
+        backwards = !backwards; // Nothing to paginate from on that side
+    const QString token = backwards ? g->backToken : g->forwardToken;
+    if( token.isEmpty() )
+    {
+        // Get a pagination token next to the message on that side first
+        Message* edge = gapEdge(gap, backwards);
+        if( !edge )
+            return false;
+        QNetworkReply* reply = requestContext(edge->eventId(), 0);
+        m_gapRequests.insert(gap, reply);
+        connect( reply, &QNetworkReply::finished, this, [this, gap, backwards, reply] {
+            reply->deleteLater();
+            if( m_gapRequests.value(gap) != reply )
+                return; // The gap has changed or is gone
+            m_gapRequests.remove(gap);
+            const QJsonObject json = replyJson(reply);
+            const QString token = json.value(backwards ? "start" : "end").toString();
+            if( token.isEmpty() )
+            {
+                emit paginationFinished(false);
+                return;
+            }
+            if( backwards )
+                gap->gap()->backToken = token;
+            else
+                gap->gap()->forwardToken = token;
+            fillGap(gap, backwards);
+        });
+        return true;
+    }
+
+    QUrlQuery query;
+    query.addQueryItem("from", token);
+    query.addQueryItem("dir", backwards ? "b" : "f");
+    query.addQueryItem("limit", QString::number(FetchPageSize));
+    QNetworkReply* reply =
+        static_cast<QuaternionConnection*>(connection())->apiGet(apiPath("/messages"), query);
+    m_gapRequests.insert(gap, reply);
+    connect( reply, &QNetworkReply::finished, this, [this, gap, backwards, reply] {
+        reply->deleteLater();
+        if( m_gapRequests.value(gap) != reply )
+            return;
+        m_gapRequests.remove(gap);
+        const QJsonObject json = replyJson(reply);
+        if( !json.isEmpty() )
+            gapFilled(gap, backwards, json);
+        emit paginationFinished(!json.isEmpty());
+    });
+    return true;
+}
+
+bool QuaternionRoom::isPaginating() const
+{
+    return !m_gapRequests.isEmpty();
+}
+
+bool QuaternionRoom::canLoadPreviousContent() const
+{
+    if( m_historyGap )
+        return true;
+    // Otherwise there's only something to load if messages were evicted
+    Message* first = firstLoadedMessage();
+    return first && messageEvents().first() != first->messageEvent();
+}
+
+void QuaternionRoom::gapFilled(Message* gap, bool backwards, const QJsonObject& json)
+{
+    // Events can only be added next to loaded messages; the gap may have
+    // been evicted in the meantime.
+    if( m_messages.indexOf(gap) < 0 )
+        return;
+
+    const QJsonArray chunk = json.value("chunk").toArray();
+    const QString end = json.value("end").toString();
+
+    // A forward page goes before the gap, so move it out of the way first
+    if( !backwards )
+        takeGap(gap);
+    const bool allNew = addFetchedEvents(chunk);
+    // The page reached the other side of the gap or the start of the room
+    const bool closed = chunk.isEmpty() || !allNew || end.isEmpty();
+
+    if( backwards )
+    {
+        if( closed )
+            removeGap(gap);
+        else
+            gap->gap()->backToken = end;
+    }
+    else if( closed )
+    {
+        if( gap == m_historyGap )
+            m_historyGap = nullptr;
+        delete gap;
+    }
+    else
+    {
+        gap->gap()->forwardToken = end;
+        gap->gap()->timestamp = eventTimestamp(chunk.last().toObject());
+        insertGap(gap);
+    }
+    resolveDateJump();
+}
+
+bool QuaternionRoom::addFetchedEvents(const QJsonArray& events)
+{
+    bool allNew = true;
+    for( const QJsonValue& value: events )
+    {
+        const QJsonObject json = value.toObject();
+        if( m_eventIds.contains(json.value("event_id").toString()) )
+        {
+            allNew = false;
+            continue;
+        }
+        if( QMatrixClient::Event* event = QMatrixClient::Event::fromJson(json) )
+            processMessageEvent(event);
+    }
+    flushNewMessages();
+    return allNew;
+}
+
+QDateTime QuaternionRoom::contiguousSince() const
+{
+    if( m_gaps.isEmpty() || m_gaps.last() == m_historyGap )
+        return QDateTime();
+    return m_gaps.last()->timestamp();
+}
+
+void QuaternionRoom::jumpToEvent(const QString& eventId, const QDateTime& timestamp)
+{
+    materialize();
+    m_jumpDate = QDateTime();
+    if( m_eventIds.contains(eventId) )
+    {
+        // Known locally, but it may have been evicted
+        if( timestamp.isValid() )
+            loadMessagesSince(timestamp);
+        while( !m_messages.find(eventId) && restoreEvictedMessages(RestorePageSize) > 0 )
+            ;
+        if( m_messages.find(eventId) )
+        {
+            emit jumpReady(eventId);
+            return;
+        }
+    }
+
+    QNetworkReply* reply = requestContext(eventId, ContextSize);
+    connect( reply, &QNetworkReply::finished, this, [this, eventId, reply] {
+        reply->deleteLater();
+        const QJsonObject json = replyJson(reply);
+        if( !json.isEmpty() )
+            contextReceived(eventId, json);
+    });
+}
+
+QNetworkReply* QuaternionRoom::requestContext(const QString& eventId, int limit)
+{
+    QUrlQuery query;
+    query.addQueryItem("limit", QString::number(limit));
+    const QString path = "/context/" + QString::fromLatin1(QUrl::toPercentEncoding(eventId));
+    return static_cast<QuaternionConnection*>(connection())->apiGet(apiPath(path), query);
+}
+
+void QuaternionRoom::contextReceived(const QString& eventId, const QJsonObject& json)
+{
+    const QJsonObject target = json.value("event").toObject();
+    const QJsonArray before = json.value("events_before").toArray();
+    const QJsonArray after = json.value("events_after").toArray();
+
+    // events_before is in reverse chronological order
+    QJsonArray window;
+    for( int i = before.size() - 1; i >= 0; --i )
+        window.append(before.at(i));
+    window.append(target);
+    for( const QJsonValue& value: after )
+        window.append(value);
+
+    auto anyKnown = [this](const QJsonArray& events) {
+        for( const QJsonValue& value: events )
+            if( m_eventIds.contains(value.toObject().value("event_id").toString()) )
+                return true;
+        return false;
+    };
+    const bool connectedAbove = anyKnown(before);
+    const bool connectedBelow = anyKnown(after);
+
+    // The window fills part of the gap it was missing from, which has to
+    // be loaded for that.
+    const QDateTime timestamp = eventTimestamp(target);
+    loadMessagesSince(timestamp);
+    Message* gap = enclosingGap(timestamp);
+    if( gap )
+    {
+        // Whatever was being loaded into the gap may not fit any more
+        if( QNetworkReply* reply = m_gapRequests.take(gap) )
+            reply->abort();
+    }
+    addFetchedEvents(window);
+
+    if( gap )
+    {
+        const QString start = json.value("start").toString();
+        const QString end = json.value("end").toString();
+        const QDateTime windowEnd = eventTimestamp(window.last().toObject());
+        if( connectedAbove && connectedBelow )
+            removeGap(gap);
+        else if( connectedAbove && gap != m_historyGap )
+        {
+            // The gap is now below the window
+            takeGap(gap);
+            gap->gap()->timestamp = windowEnd;
+            gap->gap()->forwardToken = end;
+            insertGap(gap);
+        }
+        else
+        {
+            // Split the gap around the window
+            const QString backToken = gap->gap()->backToken;
+            gap->gap()->backToken = start;
+            if( !connectedBelow )
+            {
+                Message* lower = new Message(windowEnd);
+                lower->gap()->forwardToken = end;
+                lower->gap()->backToken = backToken;
+                insertGap(lower);
+            }
+        }
+    }
+
+    if( m_messages.find(eventId) )
+        emit jumpReady(eventId);
+}
+
+void QuaternionRoom::jumpToDate(const QDateTime& timestamp)
+{
+    m_jumpDate = timestamp;
+    loadMessagesSince(timestamp);
+    resolveDateJump();
+}
+
+void QuaternionRoom::resolveDateJump()
+{
+    if( !m_jumpDate.isValid() )
+        return;
+
+    int row = m_messages.lowerBound(m_jumpDate);
+    if( row > 0 && m_messages.at(row - 1)->isGap() )
+    {
+        // The time falls into a gap: page back into it from its newer
+        // side until it's covered; this gets called again after each page.
+        Message* gap = m_messages.at(row - 1);
+        if( gapEdge(gap, true) )
+        {
+            fillGap(gap, true);
+            return;
+        }
+    }
+    m_jumpDate = QDateTime();
+
+    while( row < m_messages.size() && m_messages.at(row)->isGap() )
+        ++row;
+    if( row == m_messages.size() )
+    {
+        // Later than anything there is; go to the newest message
+        while( row > 0 && m_messages.at(row - 1)->isGap() )
+            --row;
+        --row;
+    }
+    if( row >= 0 )
+        emit jumpReady(m_messages.at(row)->eventId());
+}
+
+Message* QuaternionRoom::firstLoadedMessage() const
+{
+    for( int i = 0; i < m_messages.size(); ++i )
+        if( !m_messages.at(i)->isGap() )
+            return m_messages.at(i);
+    return nullptr;
+}
+
+bool QuaternionRoom::isMaterialized(const QDateTime& timestamp) const
+{
+    if( m_summaryOnly )
+        return false;
+    Message* first = firstLoadedMessage();
+    if( !first || !(timestamp < first->timestamp()) )
+        return true;
+    // Older than all loaded messages: only if none has been evicted
+    return messageEvents().isEmpty() || messageEvents().first() == first->messageEvent();
+}
+
+Message* QuaternionRoom::enclosingGap(const QDateTime& timestamp) const
+{
+    Message* enclosing = nullptr;
+    for( Message* gap: m_gaps )
+    {
+        if( timestamp < gap->timestamp() )
+            break;
+        enclosing = gap;
+    }
+    return enclosing;
+}
+
+void QuaternionRoom::insertGap(Message* gap)
+{
+    m_gaps.insert(std::upper_bound(m_gaps.begin(), m_gaps.end(), gap, earlier), gap);
+    if( !isMaterialized(gap->timestamp()) )
+        return;
+    const int row = m_messages.insertionPos(gap);
+    emit messagesAboutToBeInserted(row, row);
+    m_messages.insert(gap);
+    emit messagesInserted();
+}
+
+void QuaternionRoom::takeGap(Message* gap)
+{
+    m_gaps.removeOne(gap);
+    const int row = m_messages.indexOf(gap);
+    if( row < 0 )
+        return;
+    emit messagesAboutToBeRemoved(row, row);
+    m_messages.takeAt(row);
+    emit messagesRemoved();
+}
+
+void QuaternionRoom::removeGap(Message* gap)
+{
+    if( QNetworkReply* reply = m_gapRequests.take(gap) )
+        reply->abort();
+    takeGap(gap);
+    if( gap == m_historyGap )
+        m_historyGap = nullptr;
+    delete gap;
+}
+
+Message* QuaternionRoom::gapEdge(Message* gap, bool backwards) const
+{
+    const int row = m_messages.indexOf(gap);
+    if( row < 0 )
+        return nullptr;
+    const int step = backwards ? 1 : -1;
+    for( int i = row + step; i >= 0 && i < m_messages.size(); i += step )
+        if( !m_messages.at(i)->isGap() )
+            return m_messages.at(i);
+    return nullptr;
+}
+
+QString QuaternionRoom::apiPath(const QString& endpoint) const
+{
+    return "/rooms/" + QString::fromLatin1(QUrl::toPercentEncoding(id())) + endpoint;
+}
+
 void QuaternionRoom::processEphemeralEvent(QMatrixClient::Event* event)
 {
     QMatrixClient::Room::processEphemeralEvent(event);
@@ -100,18 +880,38 @@ void QuaternionRoom::processEphemeralEvent(QMatrixClient::Event* event)
     if( m_unreadMessages &&
             (messageEvents().isEmpty() || lastReadId == messageEvents().last()->id()) )
     {
-        m_unreadMessages = false;
-        emit unreadMessagesChanged(this);
+        setUnreadMessages(false);
         qDebug() << displayName() << "no unread messages";
     }
 }
 
-void QuaternionRoom::countChanged()
+void QuaternionRoom::setUnreadMessages(bool unread)
+{
+    m_unreadMessages = unread;
+    emit unreadMessagesChanged(this);
+    summaryChanged(UnreadChange);
+}
+
+void QuaternionRoom::nameChanged()
+{
+    summaryChanged(NameChange);
+}
+
+void QuaternionRoom::countChanged(SummaryChange change)
 {
     if( m_shown )
     {
         resetNotificationCount();
         resetHighlightCount();
     }
+    summaryChanged(change);
+}
+
+void QuaternionRoom::summaryChanged(int changes)
+{
+    // Reported through the connection rather than by the room itself so
+    // that views need one connection for all rooms instead of several
+    // for each of them.
+    emit static_cast<QuaternionConnection*>(connection())->roomSummaryChanged(this, changes);
 }
 
@@ -21,40 +21,275 @@
 #define QUATERNIONROOM_H
 
 #include "lib/room.h"
+#include "timeline.h"
 
+#include <QtCore/QHash>
+#include <QtCore/QJsonObject>
+#include <QtCore/QSet>
+#include <QtCore/QSharedPointer>
+
+class HighlightMatcher;
 class Message;
+class QJsonArray;
+class QNetworkReply;
 
 class QuaternionRoom: public QMatrixClient::Room
 {
         Q_OBJECT
     public:
+        /** What QuaternionConnection::roomSummaryChanged() reports */
+        enum SummaryChange {
+            NameChange = 0x1,
+            /** The unread flag or the notification count */
+            UnreadChange = 0x2,
+            HighlightChange = 0x4,
+            /** New events; lastActivity() may have changed */
+            ActivityChange = 0x8,
+            /** Joined, left or got invited */
+            JoinStateChange = 0x10
+        };
+
         QuaternionRoom(QMatrixClient::Connection* connection, QString roomId);
 
         /**
          * set/get whether this room is currently show to the user.
-         * This is used to mark messages as read.
+         * This is used to mark messages as read. Showing the room for
+         * the first time builds its timeline.
          */
         void setShown(bool shown);
         bool isShown();
+        /**
+         * Keeps the rows around the view anchor while the room is
+         * hidden, for views kept around to switch back to quickly, as
+         * long as the timeline stays within twice the window; beyond
+         * that it's trimmed as usual.
+         */
+        void setKeptWarm(bool warm);
+        /**
+         * Called by the view with the timestamp of the first row it
+         * shows. While the room is shown or kept warm, trimming keeps
+         * that row and some rows above it; scrolling back up restores
+         * the rest. Until the view reports, such a room isn't trimmed.
+         */
+        void setViewAnchor(const QDateTime& timestamp);
+
+        /**
+         * Whether the room only keeps its summary: name, avatar, counts
+         * and last activity come from the room state as usual, but no
+         * messages are built and messages() stays empty. Rooms start
+         * that way; the timeline is built from the room's events when
+         * the room is first shown or navigated in.
+         */
+        bool isSummaryOnly() const;
 
-        QList<Message*> messages() const;
+        const Timeline& messages() const;
 
         bool hasUnreadMessages();
+        /** Timestamp of the newest event, invalid if there's none */
+        QDateTime lastActivity() const;
+
+        /**
+         * The power level of the user in the room, as set by the room's
+         * m.room.power_levels state; 0 if the room has none.
+         */
+        int powerLevel(const QString& userId) const;
+        /** The content of the power levels state event */
+        QJsonObject powerLevels() const;
+        /** Called by the connection when the power levels change */
+        void setPowerLevels(const QJsonObject& content);
+
+        /**
+         * The avatar of the member as set by their latest join event in
+         * this room; falls back to QuaternionConnection::avatarUrl() if
+         * the room has seen none. The library doesn't keep it.
+         */
+        QUrl memberAvatarUrl(const QString& userId) const;
+        /**
+         * Called by the connection for member events; returns whether
+         * the avatar changed. An empty URL on a join removes the avatar.
+         */
+        bool setMemberAvatarUrl(const QString& userId, const QUrl& url);
+        /** Called by the connection when the member leaves the room */
+        void forgetMemberAvatarUrl(const QString& userId);
+
+        /**
+         * Incremented each time the member is renamed; render records of
+         * messages built for an older generation are outdated.
+         */
+        int memberGeneration(const QString& userId) const;
+
+        /**
+         * The matcher for highlights in this room: the local user id,
+         * own display name in the room and the configured keywords.
+         * Rebuilt when any of them changes.
+         */
+        QSharedPointer<const HighlightMatcher> highlightMatcher();
+        /**
+         * Rebuilds the matcher and re-evaluates the messages it affects:
+         * if keywords were only added, only messages not yet highlighted
+         * are rescanned; if keywords were only removed, only highlighted
+         * ones are.
+         */
+        void refreshHighlights();
+
+        /**
+         * Hands over messages built in advance (e.g. by the sync worker
+         * thread) for events that are about to be processed by the room.
+         * The room takes ownership of them.
+         */
+        void addPreparedMessages(const QHash<QMatrixClient::Event*, Message*>& messages);
+        /** Deletes prepared messages that turned out to be unused */
+        void discardPreparedMessages();
+
+        /**
+         * Loads older messages: re-creates messages evicted from the
+         * timeline window if there are any, otherwise fills the gap
+         * before the oldest known event. Returns false if it did neither.
+         */
+        bool loadPreviousContent();
+        /**
+         * Re-creates evicted messages back to the given time, e.g. to
+         * show a search result. Returns false if the room has no
+         * messages that old locally.
+         */
+        bool loadMessagesSince(const QDateTime& timestamp);
+
+        /**
+         * Records that the server skipped events before the timeline of
+         * the sync batch about to be processed. Called by the connection;
+         * prevBatch is the batch's prev_batch token and since is the
+         * token the sync was made from.
+         */
+        void addSyncGap(const QString& prevBatch, const QString& since);
+        /**
+         * Loads a page of the events missing in the gap, paginating from
+         * its newer side if backwards is true and from its older side
+         * otherwise; the gap shrinks or is removed. Does nothing if the
+         * gap is being filled already. Returns whether a request was sent;
+         * it isn't for a gap with nothing to paginate from on either side.
+         */
+        bool fillGap(Message* gap, bool backwards);
+        /**
+         * Whether a gap is being filled; only one gap of a room is
+         * filled at a time, fillGap() does nothing in the meantime.
+         */
+        bool isPaginating() const;
+        /**
+         * Whether there are older messages to load, evicted locally or
+         * on the server; false once the start of the room is loaded.
+         */
+        bool canLoadPreviousContent() const;
+        /**
+         * The newest point in time at which the timeline has a gap; the
+         * events after it are contiguous. Invalid if there's no gap
+         * except, possibly, older history not loaded yet.
+         */
+        QDateTime contiguousSince() const;
+
+        /**
+         * Makes sure the event is in messages(), loading it with some
+         * context from the server if needed, and emits jumpReady().
+         */
+        void jumpToEvent(const QString& eventId, const QDateTime& timestamp = QDateTime());
+        /**
+         * Same for the first message at or after the given time;
+         * history is paginated back until that time if needed.
+         */
+        void jumpToDate(const QDateTime& timestamp);
+
+    public slots:
+        /**
+         * Adds the messages collected since the last call to the
+         * timeline. Called by the connection after each sync batch;
+         * otherwise happens on the next event loop turn.
+         */
+        void flushNewMessages();
 
     signals:
-        void newMessage(Message* message);
+        /**
+         * Emitted around each contiguous range of rows inserted into
+         * or removed from messages(), so that models can be views
+         * over the room's timeline.
+         */
+        void messagesAboutToBeInserted(int first, int last);
+        void messagesInserted();
+        void messagesAboutToBeRemoved(int first, int last);
+        void messagesRemoved();
+        void highlightsChanged(QList<Message*> messages);
         void unreadMessagesChanged(QuaternionRoom* room);
+        void powerLevelsChanged();
+        /** The target of jumpToEvent() or jumpToDate() is now in messages() */
+        void jumpReady(QString eventId);
+        /** A request started by fillGap() has finished */
+        void paginationFinished(bool success);
 
     protected:
         virtual void processMessageEvent(QMatrixClient::Event* event) override;
         virtual void processEphemeralEvent(QMatrixClient::Event* event) override;
 
     private slots:
-        void countChanged();
+        void nameChanged();
+        void processMemberRename(QMatrixClient::User* user);
+        /**
+         * Evicts the oldest messages beyond the timeline window; their
+         * events stay in the room and the messages are re-created by
+         * loadPreviousContent() when needed. Rows at and just above the
+         * view anchor of a shown or warm room stay.
+         */
+        void trimTimeline();
 
     private:
-        QList<Message*> m_messages;
+        void materialize();
+        void setUnreadMessages(bool unread);
+        void countChanged(SummaryChange change);
+        void summaryChanged(int changes);
+        int restoreEvictedMessages(int count);
+        void insertMessages(const QList<Message*>& messages);
+
+        Message* firstLoadedMessage() const;
+        bool isMaterialized(const QDateTime& timestamp) const;
+        Message* enclosingGap(const QDateTime& timestamp) const;
+        void insertGap(Message* gap);
+        void takeGap(Message* gap);
+        void removeGap(Message* gap);
+        /** Returns the message on that side of the gap, or nullptr */
+        Message* gapEdge(Message* gap, bool backwards) const;
+        void gapFilled(Message* gap, bool backwards, const QJsonObject& json);
+        /**
+         * Processes events fetched from the server that the room doesn't
+         * have yet; returns false if some of them were known already.
+         */
+        bool addFetchedEvents(const QJsonArray& events);
+        QNetworkReply* requestContext(const QString& eventId, int limit);
+        void contextReceived(const QString& eventId, const QJsonObject& json);
+        void resolveDateJump();
+
+        QString apiPath(const QString& endpoint) const;
+
+        Timeline m_messages;
+        QHash<QMatrixClient::Event*, Message*> m_preparedMessages;
+        QList<Message*> m_pendingMessages;
+        /** Events processed since the last flushNewMessages() */
+        QList<QMatrixClient::Event*> m_pendingEvents;
+        QMatrixClient::Event* m_pendingReadMarker;
+        QHash<QString, int> m_memberGenerations;
+        QHash<QString, QUrl> m_memberAvatarUrls;
+        QJsonObject m_powerLevels;
+        QHash<QString, int> m_userPowerLevels;
+        int m_usersDefaultPowerLevel;
+        QSharedPointer<const HighlightMatcher> m_highlightMatcher;
+        QString m_highlightDisplayname;
+        QSet<QString> m_eventIds;
+        /** Sorted by timestamp; only those in the loaded range are in m_messages */
+        QList<Message*> m_gaps;
+        /** The gap before the oldest known event, or nullptr if there's none */
+        Message* m_historyGap;
+        QHash<Message*, QNetworkReply*> m_gapRequests;
+        QDateTime m_jumpDate;
+        QDateTime m_viewAnchor;
         bool m_shown;
+        bool m_keptWarm;
+        bool m_summaryOnly;
         bool m_unreadMessages;
 };
 
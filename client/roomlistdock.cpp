@@ -19,6 +19,7 @@
 
 #include "roomlistdock.h"
 
+#include <QtWidgets/QActionGroup>
 #include <QtWidgets/QMenu>
 
 #include "models/roomlistmodel.h"
@@ -50,6 +51,23 @@ RoomListDock::RoomListDock(QWidget* parent)
     connect(leaveAction, &QAction::triggered, this, &RoomListDock::menuLeaveSelected);
     contextMenu->addAction(leaveAction);
 
+    QMenu* sortMenu = contextMenu->addMenu(tr("Sort Rooms"));
+    sortActions = new QActionGroup(this);
+    const QList<QPair<QString, RoomListModel::SortOrder>> sortOrders {
+        { tr("By Activity"), RoomListModel::ByActivity },
+        { tr("Unread First"), RoomListModel::UnreadFirst },
+        { tr("By Join State"), RoomListModel::ByJoinState }
+    };
+    for( const auto& sortOrder: sortOrders )
+    {
+        QAction* action = sortActions->addAction(sortOrder.first);
+        action->setCheckable(true);
+        action->setChecked(model->sortOrder() == sortOrder.second);
+        action->setData(int(sortOrder.second));
+        sortMenu->addAction(action);
+    }
+    connect(sortActions, &QActionGroup::triggered, this, &RoomListDock::sortOrderSelected);
+
     setContextMenuPolicy(Qt::CustomContextMenu);
     connect(this, &QWidget::customContextMenuRequested, this, &RoomListDock::showContextMenu);
 }
@@ -67,7 +85,13 @@ void RoomListDock::showContextMenu(const QPoint& pos)
 {
     QModelIndex index = view->indexAt(view->mapFromParent(pos));
     if( !index.isValid() )
+    {
+        // Only sorting applies to the list as a whole
+        joinAction->setEnabled(false);
+        leaveAction->setEnabled(false);
+        contextMenu->popup(mapToGlobal(pos));
         return;
+    }
     QuaternionRoom* room = model->roomAt(index.row());
 
     if( room->joinState() == QMatrixClient::JoinState::Join )
@@ -105,3 +129,16 @@ void RoomListDock::menuLeaveSelected()
     QuaternionRoom* room = model->roomAt(index.row());
     connection->leaveRoom(room);
 }
+
+void RoomListDock::sortOrderSelected(QAction* action)
+{
+    model->setSortOrder(RoomListModel::SortOrder(action->data().toInt()));
+}
+
+void RoomListDock::selectRoom(QMatrixClient::Room* room)
+{
+    const int row = model->rowOf(static_cast<QuaternionRoom*>(room));
+    if( row >= 0 )
+        view->setCurrentIndex(model->index(row));
+    emit roomSelected(room);
+}
@@ -28,6 +28,7 @@
 #include "lib/connection.h"
 
 class RoomListModel;
+class QActionGroup;
 
 class RoomListDock : public QDockWidget
 {
@@ -37,6 +38,8 @@ class RoomListDock : public QDockWidget
         virtual ~RoomListDock();
 
         void setConnection(QMatrixClient::Connection* newConnection );
+        /** Makes the room current in the list and emits roomSelected() */
+        void selectRoom(QMatrixClient::Room* room);
 
     signals:
         void roomSelected(QMatrixClient::Room* room);
@@ -45,6 +48,7 @@ class RoomListDock : public QDockWidget
         void showContextMenu(const QPoint& pos);
         void menuJoinSelected();
         void menuLeaveSelected();
+        void sortOrderSelected(QAction* action);
 
     private:
         QMatrixClient::Connection* connection;
@@ -53,6 +57,7 @@ class RoomListDock : public QDockWidget
         QMenu* contextMenu;
         QAction* joinAction;
         QAction* leaveAction;
+        QActionGroup* sortActions;
 };
 
 #endif // ROOMLISTDOCK_H
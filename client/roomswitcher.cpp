@@ -0,0 +1,290 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "roomswitcher.h"
+
+#include <QtCore/QEvent>
+#include <QtCore/QSet>
+#include <QtGui/QKeyEvent>
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QListWidget>
+#include <QtWidgets/QVBoxLayout>
+
+#include "lib/connection.h"
+#include "lib/room.h"
+#include "quaternionconnection.h"
+#include "quaternionroom.h"
+
+#include <algorithm>
+
+namespace
+{
+    const int MaxResults = 20;
+
+    QStringList words(const QString& text)
+    {
+        QStringList result;
+        QString word;
+        for( const QChar c: text )
+        {
+            if( c.isLetterOrNumber() )
+                word += c.toCaseFolded();
+            else if( !word.isEmpty() )
+            {
+                result.append(word);
+                word.clear();
+            }
+        }
+        if( !word.isEmpty() )
+            result.append(word);
+        return result;
+    }
+
+    bool isSubsequence(const QString& needle, const QString& haystack)
+    {
+        int pos = 0;
+        for( const QChar c: needle )
+        {
+            pos = haystack.indexOf(c, pos);
+            if( pos < 0 )
+                return false;
+            ++pos;
+        }
+        return true;
+    }
+
+    bool moreRecent(const QuaternionRoom* a, const QuaternionRoom* b)
+    {
+        return a->lastActivity() > b->lastActivity();
+    }
+}
+
+RoomSwitcher::RoomSwitcher(QWidget* parent)
+    : QDialog(parent)
+    , m_connection(nullptr)
+{
+    setWindowTitle(tr("Switch Room"));
+
+    m_queryEdit = new QLineEdit();
+    m_queryEdit->setPlaceholderText(tr("Room name or alias"));
+    m_queryEdit->installEventFilter(this);
+    m_results = new QListWidget();
+
+    connect( m_queryEdit, &QLineEdit::textChanged, this, &RoomSwitcher::updateResults );
+    connect( m_queryEdit, &QLineEdit::returnPressed, this, &RoomSwitcher::selectCurrent );
+    connect( m_results, &QListWidget::itemActivated, this, &RoomSwitcher::selectCurrent );
+
+    QVBoxLayout* layout = new QVBoxLayout();
+    layout->addWidget(m_queryEdit);
+    layout->addWidget(m_results);
+    setLayout(layout);
+}
+
+RoomSwitcher::~RoomSwitcher()
+{
+    clearIndex();
+}
+
+void RoomSwitcher::setConnection(QMatrixClient::Connection* connection)
+{
+    if( m_connection )
+        m_connection->disconnect( this );
+    clearIndex();
+    m_connection = connection;
+    if( !m_connection )
+        return;
+
+    connect( m_connection, &QMatrixClient::Connection::newRoom, this, &RoomSwitcher::addRoom );
+    connect( static_cast<QuaternionConnection*>(m_connection), &QuaternionConnection::roomSummaryChanged,
+             this, &RoomSwitcher::roomSummaryChanged );
+    for( QMatrixClient::Room* r: m_connection->roomMap() )
+    {
+        Entry* entry = new Entry { static_cast<QuaternionRoom*>(r), QString(), QStringList() };
+        m_entries.insert(entry->room, entry);
+        m_recent.append(entry);
+        // Sorted once below rather than word by word
+        readNames(entry);
+        for( const QString& word: entry->words )
+            m_keys.append({ word, entry });
+    }
+    std::stable_sort(m_recent.begin(), m_recent.end(),
+        [](const Entry* a, const Entry* b) { return moreRecent(a->room, b->room); });
+    std::sort(m_keys.begin(), m_keys.end());
+}
+
+void RoomSwitcher::showEvent(QShowEvent* event)
+{
+    m_queryEdit->clear();
+    updateResults();
+    m_queryEdit->setFocus();
+    QDialog::showEvent(event);
+}
+
+bool RoomSwitcher::eventFilter(QObject* watched, QEvent* event)
+{
+    // Up and Down in the query field move through the results
+    if( watched == m_queryEdit && event->type() == QEvent::KeyPress )
+    {
+        const int key = static_cast<QKeyEvent*>(event)->key();
+        if( (key == Qt::Key_Up || key == Qt::Key_Down) && m_results->count() > 0 )
+        {
+            const int step = key == Qt::Key_Up ? -1 : 1;
+            const int row = qBound(0, m_results->currentRow() + step, m_results->count() - 1);
+            m_results->setCurrentRow(row);
+            return true;
+        }
+    }
+    return QDialog::eventFilter(watched, event);
+}
+
+void RoomSwitcher::addRoom(QMatrixClient::Room* room)
+{
+    QuaternionRoom* qRoom = static_cast<QuaternionRoom*>(room);
+    if( m_entries.contains(qRoom) )
+        return;
+    Entry* entry = new Entry { qRoom, QString(), QStringList() };
+    m_entries.insert(qRoom, entry);
+    m_recent.append(entry);
+    reposition(entry);
+    indexNames(entry);
+}
+
+void RoomSwitcher::roomSummaryChanged(QuaternionRoom* room, int changes)
+{
+    Entry* entry = m_entries.value(room);
+    if( !entry )
+        return;
+    if( changes & QuaternionRoom::NameChange )
+    {
+        unindexNames(entry);
+        indexNames(entry);
+    }
+    if( changes & QuaternionRoom::ActivityChange )
+        reposition(entry);
+}
+
+void RoomSwitcher::clearIndex()
+{
+    qDeleteAll(m_recent);
+    m_entries.clear();
+    m_recent.clear();
+    m_keys.clear();
+}
+
+void RoomSwitcher::indexNames(Entry* entry)
+{
+    readNames(entry);
+    for( const QString& word: entry->words )
+    {
+        const Key key { word, entry };
+        m_keys.insert(std::upper_bound(m_keys.begin(), m_keys.end(), key), key);
+    }
+}
+
+void RoomSwitcher::readNames(Entry* entry)
+{
+    QuaternionRoom* room = entry->room;
+    QStringList names { room->displayName() };
+    names << room->aliases();
+    if( !room->canonicalAlias().isEmpty() )
+        names << room->canonicalAlias();
+
+    entry->haystack = names.join(' ').toCaseFolded();
+    entry->words.clear();
+    for( const QString& name: names )
+    {
+        entry->words << name.toCaseFolded();
+        entry->words << words(name);
+    }
+    entry->words.removeDuplicates();
+}
+
+void RoomSwitcher::unindexNames(Entry* entry)
+{
+    for( const QString& word: entry->words )
+    {
+        auto it = std::lower_bound(m_keys.begin(), m_keys.end(), Key { word, nullptr });
+        while( it != m_keys.end() && it->text == word && it->entry != entry )
+            ++it;
+        if( it != m_keys.end() && it->text == word )
+            m_keys.erase(it);
+    }
+    entry->words.clear();
+}
+
+void RoomSwitcher::reposition(Entry* entry)
+{
+    m_recent.removeOne(entry);
+    auto it = std::upper_bound(m_recent.begin(), m_recent.end(), entry,
+        [](const Entry* a, const Entry* b) { return moreRecent(a->room, b->room); });
+    m_recent.insert(it, entry);
+}
+
+void RoomSwitcher::updateResults()
+{
+    m_results->clear();
+    const QString query = m_queryEdit->text().trimmed().toCaseFolded();
+
+    // Prefix matches come first, then other matches; within each group
+    // the most recently active rooms go first.
+    QVector<Entry*> prefixMatches;
+    QSet<Entry*> matched;
+    if( !query.isEmpty() )
+    {
+        for( auto it = std::lower_bound(m_keys.begin(), m_keys.end(), Key { query, nullptr });
+             it != m_keys.end() && it->text.startsWith(query); ++it )
+        {
+            if( !matched.contains(it->entry) )
+            {
+                matched.insert(it->entry);
+                prefixMatches.append(it->entry);
+            }
+        }
+        std::stable_sort(prefixMatches.begin(), prefixMatches.end(),
+            [](const Entry* a, const Entry* b) { return moreRecent(a->room, b->room); });
+    }
+    QVector<Entry*> results = prefixMatches.mid(0, MaxResults);
+    for( int i = 0; i < m_recent.size() && results.size() < MaxResults; ++i )
+    {
+        Entry* entry = m_recent.at(i);
+        if( !matched.contains(entry) && isSubsequence(query, entry->haystack) )
+            results.append(entry);
+    }
+
+    for( Entry* entry: results )
+    {
+        QListWidgetItem* item = new QListWidgetItem(entry->room->displayName(), m_results);
+        item->setData(Qt::UserRole, entry->room->id());
+    }
+    if( m_results->count() > 0 )
+        m_results->setCurrentRow(0);
+}
+
+void RoomSwitcher::selectCurrent()
+{
+    QListWidgetItem* item = m_results->currentItem();
+    if( !item || !m_connection )
+        return;
+    // Rooms are looked up by id; the index may have changed meanwhile
+    QMatrixClient::Room* room = m_connection->roomMap().value(item->data(Qt::UserRole).toString());
+    if( !room )
+        return;
+    emit roomSelected(room);
+    accept();
+}
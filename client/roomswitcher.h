@@ -0,0 +1,101 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef ROOMSWITCHER_H
+#define ROOMSWITCHER_H
+
+#include <QtWidgets/QDialog>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+namespace QMatrixClient
+{
+    class Connection;
+    class Room;
+}
+
+class QuaternionRoom;
+class QLineEdit;
+class QListWidget;
+
+/**
+ * A keyboard-driven dialog to jump to a room by typing a part of its
+ * name or alias. Word prefixes are looked up in a sorted index, other
+ * matches are found by a subsequence scan over the case-folded names;
+ * both are cheap enough to run on every key press with 10k rooms. The
+ * index follows room summary changes, so opening the dialog is free.
+ */
+class RoomSwitcher: public QDialog
+{
+        Q_OBJECT
+    public:
+        RoomSwitcher(QWidget* parent = nullptr);
+        virtual ~RoomSwitcher();
+
+        void setConnection(QMatrixClient::Connection* connection);
+
+    signals:
+        void roomSelected(QMatrixClient::Room* room);
+
+    protected:
+        void showEvent(QShowEvent* event) override;
+        bool eventFilter(QObject* watched, QEvent* event) override;
+
+    private slots:
+        void updateResults();
+        void selectCurrent();
+        void addRoom(QMatrixClient::Room* room);
+        void roomSummaryChanged(QuaternionRoom* room, int changes);
+
+    private:
+        struct Entry
+        {
+            QuaternionRoom* room;
+            /** Case-folded display name and aliases */
+            QString haystack;
+            /** Case-folded names, aliases and their words */
+            QStringList words;
+        };
+        struct Key
+        {
+            QString text;
+            Entry* entry;
+            bool operator<(const Key& other) const { return text < other.text; }
+        };
+
+        void clearIndex();
+        /** Fills in the haystack and words of the entry from its room */
+        void readNames(Entry* entry);
+        void indexNames(Entry* entry);
+        void unindexNames(Entry* entry);
+        /** Moves the entry to its place in m_recent */
+        void reposition(Entry* entry);
+
+        QMatrixClient::Connection* m_connection;
+        QHash<QuaternionRoom*, Entry*> m_entries;
+        /** Most recently active first */
+        QVector<Entry*> m_recent;
+        /** Words of all entries, sorted */
+        QVector<Key> m_keys;
+
+        QLineEdit* m_queryEdit;
+        QListWidget* m_results;
+};
+
+#endif // ROOMSWITCHER_H
@@ -0,0 +1,158 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "searchdock.h"
+
+#include <QtCore/QTimer>
+#include <QtWidgets/QCheckBox>
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QListWidget>
+#include <QtWidgets/QVBoxLayout>
+
+#include "lib/room.h"
+#include "lib/events/roommessageevent.h"
+#include "quaternionconnection.h"
+#include "quaternionroom.h"
+#include "message.h"
+
+namespace
+{
+    // Queries are sent once typing pauses for this long
+    const int SearchDelay = 300;
+
+    enum ResultRoles {
+        RoomIdRole = Qt::UserRole + 1,
+        EventIdRole,
+        TimestampRole
+    };
+}
+
+SearchDock::SearchDock(QWidget* parent)
+    : QDockWidget("Search", parent)
+    , m_connection(nullptr)
+    , m_currentRoom(nullptr)
+    , m_lastRequestId(0)
+{
+    setFeatures(DockWidgetMovable | DockWidgetFloatable);
+    setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
+
+    m_queryEdit = new QLineEdit();
+    m_queryEdit->setPlaceholderText(tr("Search messages"));
+    m_currentRoomOnly = new QCheckBox(tr("Current room only"));
+    m_results = new QListWidget();
+    m_results->setWordWrap(true);
+
+    m_searchTimer = new QTimer(this);
+    m_searchTimer->setSingleShot(true);
+    m_searchTimer->setInterval(SearchDelay);
+    connect( m_searchTimer, &QTimer::timeout, this, &SearchDock::startSearch );
+    connect( m_queryEdit, &QLineEdit::textChanged, m_searchTimer, static_cast<void (QTimer::*)()>(&QTimer::start) );
+    connect( m_queryEdit, &QLineEdit::returnPressed, this, &SearchDock::startSearch );
+    connect( m_currentRoomOnly, &QCheckBox::toggled, this, &SearchDock::startSearch );
+    connect( m_results, &QListWidget::itemActivated, this, &SearchDock::itemActivated );
+    connect( m_results, &QListWidget::itemClicked, this, &SearchDock::itemActivated );
+
+    QWidget* widget = new QWidget();
+    QVBoxLayout* layout = new QVBoxLayout();
+    layout->addWidget(m_queryEdit);
+    layout->addWidget(m_currentRoomOnly);
+    layout->addWidget(m_results);
+    widget->setLayout(layout);
+    setWidget(widget);
+}
+
+SearchDock::~SearchDock()
+{
+}
+
+void SearchDock::setConnection(QuaternionConnection* connection)
+{
+    m_connection = connection;
+    m_results->clear();
+    if( m_connection && m_connection->searchIndex() )
+        connect( m_connection->searchIndex(), &SearchIndex::searchFinished,
+                 this, &SearchDock::searchFinished, Qt::UniqueConnection );
+}
+
+void SearchDock::setRoom(QMatrixClient::Room* room)
+{
+    if( room == m_currentRoom )
+        return;
+    m_currentRoom = room;
+    if( m_currentRoomOnly->isChecked() )
+        startSearch();
+}
+
+void SearchDock::startSearch()
+{
+    m_searchTimer->stop();
+    // Results of requests still in flight are dropped when they arrive
+    ++m_lastRequestId;
+    m_results->clear();
+
+    const QString query = m_queryEdit->text().trimmed();
+    if( query.isEmpty() || !m_connection || !m_connection->searchIndex() )
+        return;
+    QString roomId;
+    if( m_currentRoomOnly->isChecked() )
+    {
+        if( !m_currentRoom )
+            return;
+        roomId = m_currentRoom->id();
+    }
+    QMetaObject::invokeMethod(m_connection->searchIndex(), "search", Qt::QueuedConnection,
+                              Q_ARG(int, m_lastRequestId), Q_ARG(QString, query),
+                              Q_ARG(QString, roomId));
+}
+
+void SearchDock::searchFinished(int requestId, QVector<SearchHit> hits)
+{
+    using namespace QMatrixClient;
+
+    if( requestId != m_lastRequestId )
+        return;
+
+    for( const SearchHit& hit: hits )
+    {
+        Room* room = m_connection->roomMap().value(hit.roomId);
+        if( !room )
+            continue;
+
+        // The index doesn't keep message texts; show them for messages
+        // that are loaded anyway.
+        QString text = QString("%1, %2").arg(room->displayName())
+                .arg(hit.timestamp.toString(Qt::DefaultLocaleShortDate));
+        Message* message = static_cast<QuaternionRoom*>(room)->messages().find(hit.eventId);
+        if( message )
+            text += "\n" + static_cast<RoomMessageEvent*>(message->messageEvent())->body();
+
+        QListWidgetItem* item = new QListWidgetItem(text, m_results);
+        item->setData(RoomIdRole, hit.roomId);
+        item->setData(EventIdRole, hit.eventId);
+        item->setData(TimestampRole, hit.timestamp);
+    }
+}
+
+void SearchDock::itemActivated(QListWidgetItem* item)
+{
+    QMatrixClient::Room* room = m_connection->roomMap().value(item->data(RoomIdRole).toString());
+    if( room )
+        emit resultActivated(room, item->data(EventIdRole).toString(),
+                             item->data(TimestampRole).toDateTime());
+}
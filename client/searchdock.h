@@ -0,0 +1,67 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef SEARCHDOCK_H
+#define SEARCHDOCK_H
+
+#include <QtWidgets/QDockWidget>
+
+#include "searchindex.h"
+
+namespace QMatrixClient
+{
+    class Room;
+}
+
+class QuaternionConnection;
+class QCheckBox;
+class QLineEdit;
+class QListWidget;
+class QListWidgetItem;
+class QTimer;
+
+class SearchDock: public QDockWidget
+{
+        Q_OBJECT
+    public:
+        SearchDock(QWidget* parent = nullptr);
+        virtual ~SearchDock();
+
+        void setConnection( QuaternionConnection* connection );
+        void setRoom( QMatrixClient::Room* room );
+
+    signals:
+        void resultActivated(QMatrixClient::Room* room, QString eventId, QDateTime timestamp);
+
+    private slots:
+        void startSearch();
+        void searchFinished(int requestId, QVector<SearchHit> hits);
+        void itemActivated(QListWidgetItem* item);
+
+    private:
+        QuaternionConnection* m_connection;
+        QMatrixClient::Room* m_currentRoom;
+        QLineEdit* m_queryEdit;
+        QCheckBox* m_currentRoomOnly;
+        QListWidget* m_results;
+        QTimer* m_searchTimer;
+        int m_lastRequestId;
+};
+
+#endif // SEARCHDOCK_H
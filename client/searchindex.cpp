@@ -0,0 +1,242 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "searchindex.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QTimer>
+
+#include <algorithm>
+
+namespace
+{
+    const quint32 IndexMagic = 0x51534958; // "QSIX"
+    // Bump this whenever the file layout changes; the index is then
+    // rebuilt from the messages as they come.
+    const quint32 IndexVersion = 1;
+    const int SaveInterval = 5 * 60 * 1000;
+    const int MaxHits = 200;
+    // Shorter trailing words are only matched exactly; expanding them as
+    // prefixes would touch most of the index.
+    const int MinPrefixLength = 3;
+
+    QVector<quint32> intersect(const QVector<quint32>& a, const QVector<quint32>& b)
+    {
+        QVector<quint32> result;
+        std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                              std::back_inserter(result));
+        return result;
+    }
+}
+
+SearchIndex::SearchIndex(QString path, QObject* parent)
+    : QObject(parent)
+    , m_path(path)
+    , m_dirty(false)
+{
+    m_saveTimer = new QTimer(this);
+    m_saveTimer->setInterval(SaveInterval);
+    connect( m_saveTimer, &QTimer::timeout, this, &SearchIndex::save );
+}
+
+void SearchIndex::load()
+{
+    m_saveTimer->start();
+
+    QFile file { m_path };
+    if( !file.open(QFile::ReadOnly) )
+    {
+        qDebug() << "No search index at" << m_path;
+        return;
+    }
+    QDataStream in { &file };
+    quint32 magic, version;
+    in >> magic >> version;
+    if( magic != IndexMagic || version != IndexVersion )
+    {
+        qDebug() << "Ignoring the search index of an unsupported version";
+        return;
+    }
+    in.setVersion(QDataStream::Qt_5_2);
+
+    QStringList roomIds;
+    quint32 count;
+    in >> roomIds >> count;
+    QVector<Entry> entries;
+    entries.reserve(int(count));
+    for( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i )
+    {
+        Entry entry;
+        in >> entry.room >> entry.timestamp >> entry.eventId;
+        entries.append(entry);
+    }
+    QMap<QString, QVector<quint32>> postings;
+    in >> postings;
+    if( in.status() != QDataStream::Ok )
+    {
+        qWarning() << "The search index at" << m_path << "is corrupt, ignoring it";
+        return;
+    }
+
+    m_roomIds = roomIds;
+    m_roomIndex.clear();
+    for( int i = 0; i < m_roomIds.size(); ++i )
+        m_roomIndex.insert(m_roomIds.at(i), quint32(i));
+    m_entries = entries;
+    m_postings = postings;
+    m_eventIds.clear();
+    for( const Entry& entry: m_entries )
+        m_eventIds.insert(entry.eventId);
+    qDebug() << "Loaded" << m_entries.size() << "message(s) into the search index";
+}
+
+void SearchIndex::save()
+{
+    if( !m_dirty )
+        return;
+
+    QDir().mkpath(QFileInfo(m_path).absolutePath());
+    QSaveFile file { m_path };
+    if( !file.open(QFile::WriteOnly) )
+    {
+        qWarning() << "Couldn't open" << m_path << "to save the search index:" << file.errorString();
+        return;
+    }
+    QDataStream out { &file };
+    out << IndexMagic << IndexVersion;
+    out.setVersion(QDataStream::Qt_5_2);
+    out << m_roomIds << quint32(m_entries.size());
+    for( const Entry& entry: m_entries )
+        out << entry.room << entry.timestamp << entry.eventId;
+    out << m_postings;
+    if( !file.commit() )
+    {
+        qWarning() << "Couldn't save the search index to" << m_path << ":" << file.errorString();
+        return;
+    }
+    m_dirty = false;
+}
+
+void SearchIndex::addDocuments(QVector<SearchDocument> documents)
+{
+    for( const SearchDocument& document: documents )
+    {
+        if( m_eventIds.contains(document.eventId) )
+            continue;
+
+        const QStringList terms = tokenize(document.body);
+        if( terms.isEmpty() )
+            continue;
+
+        auto roomIt = m_roomIndex.find(document.roomId);
+        if( roomIt == m_roomIndex.end() )
+        {
+            roomIt = m_roomIndex.insert(document.roomId, quint32(m_roomIds.size()));
+            m_roomIds.append(document.roomId);
+        }
+        const quint32 doc = quint32(m_entries.size());
+        m_entries.append({ roomIt.value(), document.timestamp.toMSecsSinceEpoch(), document.eventId });
+        m_eventIds.insert(document.eventId);
+
+        // Document ids only grow, so the postings stay sorted
+        for( const QString& term: terms )
+        {
+            QVector<quint32>& docs = m_postings[term];
+            if( docs.isEmpty() || docs.last() != doc )
+                docs.append(doc);
+        }
+        m_dirty = true;
+    }
+}
+
+void SearchIndex::search(int requestId, QString query, QString roomId)
+{
+    const QStringList terms = tokenize(query);
+    QVector<quint32> docs;
+    for( int i = 0; i < terms.size(); ++i )
+    {
+        const QString& term = terms.at(i);
+        const QVector<quint32> termDocs =
+            i == terms.size() - 1 && term.size() >= MinPrefixLength
+            ? prefixPostings(term) : m_postings.value(term);
+        docs = i == 0 ? termDocs : intersect(docs, termDocs);
+        if( docs.isEmpty() )
+            break;
+    }
+
+    const quint32 room = m_roomIndex.value(roomId, quint32(-1));
+    QVector<const Entry*> matches;
+    for( quint32 doc: docs )
+    {
+        const Entry& entry = m_entries.at(int(doc));
+        if( roomId.isEmpty() || entry.room == room )
+            matches.append(&entry);
+    }
+    std::sort(matches.begin(), matches.end(), [](const Entry* a, const Entry* b) {
+        return a->timestamp > b->timestamp;
+    });
+
+    QVector<SearchHit> hits;
+    for( int i = 0; i < qMin(matches.size(), MaxHits); ++i )
+    {
+        const Entry* entry = matches.at(i);
+        hits.append({ m_roomIds.at(int(entry->room)), entry->eventId,
+                      QDateTime::fromMSecsSinceEpoch(entry->timestamp) });
+    }
+    emit searchFinished(requestId, hits);
+}
+
+QStringList SearchIndex::tokenize(const QString& text)
+{
+    QStringList terms;
+    QString term;
+    for( const QChar c: text )
+    {
+        if( c.isLetterOrNumber() )
+            term += c.toCaseFolded();
+        else if( !term.isEmpty() )
+        {
+            terms.append(term);
+            term.clear();
+        }
+    }
+    if( !term.isEmpty() )
+        terms.append(term);
+    terms.removeDuplicates();
+    return terms;
+}
+
+QVector<quint32> SearchIndex::prefixPostings(const QString& prefix) const
+{
+    QVector<quint32> docs;
+    for( auto it = m_postings.lowerBound(prefix);
+         it != m_postings.end() && it.key().startsWith(prefix); ++it )
+    {
+        QVector<quint32> merged;
+        std::set_union(docs.begin(), docs.end(), it->begin(), it->end(),
+                       std::back_inserter(merged));
+        docs.swap(merged);
+    }
+    return docs;
+}
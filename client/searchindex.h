@@ -0,0 +1,107 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QtCore/QObject>
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+class QTimer;
+
+struct SearchDocument
+{
+    QString roomId;
+    QString eventId;
+    QDateTime timestamp;
+    QString body;
+};
+
+struct SearchHit
+{
+    QString roomId;
+    QString eventId;
+    QDateTime timestamp;
+};
+
+/**
+ * An inverted index over message bodies, kept on disk between sessions.
+ * It is meant to live in its own thread: all the work happens in slots
+ * invoked through queued connections, and results come back through
+ * searchFinished().
+ */
+class SearchIndex: public QObject
+{
+        Q_OBJECT
+    public:
+        explicit SearchIndex(QString path, QObject* parent = nullptr);
+
+    public slots:
+        /**
+         * Reads the index saved by a previous session; invoke it before
+         * the first addDocuments(). Also starts saving the index
+         * periodically.
+         */
+        void load();
+        /** Writes the index to disk if anything has been added */
+        void save();
+        /** Adds documents; those already in the index are skipped */
+        void addDocuments(QVector<SearchDocument> documents);
+        /**
+         * Finds messages containing all words of the query, the last
+         * one also as a prefix; newest first. An empty roomId searches
+         * all rooms.
+         */
+        void search(int requestId, QString query, QString roomId);
+
+    signals:
+        void searchFinished(int requestId, QVector<SearchHit> hits);
+
+    private:
+        struct Entry
+        {
+            quint32 room;
+            qint64 timestamp;
+            QString eventId;
+        };
+
+        static QStringList tokenize(const QString& text);
+        QVector<quint32> prefixPostings(const QString& prefix) const;
+
+        QString m_path;
+        QStringList m_roomIds;
+        QHash<QString, quint32> m_roomIndex;
+        QVector<Entry> m_entries;
+        QSet<QString> m_eventIds;
+        QMap<QString, QVector<quint32>> m_postings;
+        bool m_dirty;
+        QTimer* m_saveTimer;
+};
+
+Q_DECLARE_METATYPE(SearchDocument)
+Q_DECLARE_METATYPE(QVector<SearchDocument>)
+Q_DECLARE_METATYPE(SearchHit)
+Q_DECLARE_METATYPE(QVector<SearchHit>)
+
+#endif // SEARCHINDEX_H
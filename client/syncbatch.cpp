@@ -0,0 +1,99 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "syncbatch.h"
+
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+
+#include "message.h"
+#include "highlightmatcher.h"
+#include "lib/events/event.h"
+
+namespace
+{
+    // Returns the content of the last power levels event in the list
+    QJsonObject findPowerLevels(const QJsonArray& events, QJsonObject found)
+    {
+        for( const QJsonValue& value: events )
+        {
+            const QJsonObject event = value.toObject();
+            if( event.value("type").toString() == "m.room.power_levels" )
+                found = event.value("content").toObject();
+        }
+        return found;
+    }
+}
+
+SyncBatch SyncBatch::fromJson(const QJsonObject& json, const HighlightSnapshot& snapshot)
+{
+    using namespace QMatrixClient;
+
+    SyncBatch batch;
+    batch.nextBatch = json.value("next_batch").toString();
+
+    const QHash<QString, JoinState> joinStates {
+        { "join", JoinState::Join },
+        { "invite", JoinState::Invite },
+        { "leave", JoinState::Leave }
+    };
+    const QJsonObject rooms = json.value("rooms").toObject();
+    for( auto it = joinStates.begin(); it != joinStates.end(); ++it )
+    {
+        const QJsonObject roomsInState = rooms.value(it.key()).toObject();
+        for( auto roomIt = roomsInState.begin(); roomIt != roomsInState.end(); ++roomIt )
+        {
+            const QJsonObject roomJson = roomIt.value().toObject();
+            const QJsonObject timeline = roomJson.value("timeline").toObject();
+            Room room { SyncRoomData(roomIt.key(), it.value(), roomJson), {},
+                        timeline.value("limited").toBool(),
+                        timeline.value("prev_batch").toString(), QJsonObject() };
+            // The timeline comes after the state, so its changes win
+            room.powerLevels = findPowerLevels(
+                roomJson.value("state").toObject().value("events").toArray(), room.powerLevels);
+            room.powerLevels = findPowerLevels(
+                timeline.value("events").toArray(), room.powerLevels);
+            QSharedPointer<const HighlightMatcher> matcher =
+                snapshot.matchers.value(roomIt.key());
+            if( matcher )
+            {
+                for( Event* event: room.data.timeline )
+                {
+                    room.messages.insert(event,
+                        new Message(event, *matcher, snapshot.localUserId));
+                }
+            }
+            batch.rooms.append(room);
+        }
+    }
+    return batch;
+}
+
+SyncBatch SyncBatch::fromPayload(const QByteArray& payload, const HighlightSnapshot& snapshot)
+{
+    QJsonParseError error;
+    QJsonDocument document = QJsonDocument::fromJson(payload, &error);
+    if( error.error != QJsonParseError::NoError )
+    {
+        SyncBatch batch;
+        batch.error = error.errorString();
+        return batch;
+    }
+    return fromJson(document.object(), snapshot);
+}
@@ -0,0 +1,82 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef SYNCBATCH_H
+#define SYNCBATCH_H
+
+#include <QtCore/QHash>
+#include <QtCore/QJsonObject>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
+
+#include "lib/jobs/syncjob.h"
+
+class HighlightMatcher;
+class Message;
+
+/**
+ * What the GUI thread needs to know to build Message objects for a sync;
+ * a copy of it is handed over to the worker thread.
+ */
+struct HighlightSnapshot
+{
+    QString localUserId;
+    /**
+     * Highlight matcher of each room with a timeline, by room id; messages
+     * are only built for these rooms.
+     */
+    QHash<QString, QSharedPointer<const HighlightMatcher>> matchers;
+};
+
+/**
+ * A sync response (or a restored state cache, which has the same layout)
+ * parsed into events and messages, ready to be spliced into the rooms.
+ */
+class SyncBatch
+{
+    public:
+        struct Room
+        {
+            QMatrixClient::SyncRoomData data;
+            QHash<QMatrixClient::Event*, Message*> messages;
+            /** Whether events were skipped before the timeline */
+            bool limited;
+            QString prevBatch;
+            /**
+             * Content of the newest m.room.power_levels event in the
+             * batch, empty if there's none; the library doesn't keep it.
+             */
+            QJsonObject powerLevels;
+        };
+
+        /**
+         * Parses the JSON and builds events and messages. Touches neither
+         * the connection nor the rooms, so it can be called from any thread.
+         */
+        static SyncBatch fromJson(const QJsonObject& json,
+                                  const HighlightSnapshot& snapshot);
+        static SyncBatch fromPayload(const QByteArray& payload,
+                                     const HighlightSnapshot& snapshot);
+
+        QString nextBatch;
+        QVector<Room> rooms;
+        QString error;
+};
+
+#endif // SYNCBATCH_H
@@ -21,8 +21,8 @@
 
 #include <QtWidgets/QWidget>
 
-#include "lib/connection.h"
-#include "lib/room.h"
+#include "quaternionconnection.h"
+#include "quaternionroom.h"
 
 SystemTray::SystemTray(QWidget* parent)
     : QSystemTrayIcon(parent)
@@ -36,23 +36,20 @@ void SystemTray::setConnection(QMatrixClient::Connection* connection)
 {
     if( m_connection )
     {
-        disconnect(m_connection, &QMatrixClient::Connection::newRoom, this, &SystemTray::newRoom);
+        disconnect(static_cast<QuaternionConnection*>(m_connection), &QuaternionConnection::roomSummaryChanged,
+                   this, &SystemTray::roomSummaryChanged);
     }
     m_connection = connection;
     if( m_connection )
     {
-        connect(m_connection, &QMatrixClient::Connection::newRoom, this, &SystemTray::newRoom);
+        connect(static_cast<QuaternionConnection*>(m_connection), &QuaternionConnection::roomSummaryChanged,
+                this, &SystemTray::roomSummaryChanged);
     }
 }
 
-void SystemTray::newRoom(QMatrixClient::Room* room)
+void SystemTray::roomSummaryChanged(QuaternionRoom* room, int changes)
 {
-    connect(room, &QMatrixClient::Room::highlightCountChanged, this, &SystemTray::highlightCountChanged);
-}
-
-void SystemTray::highlightCountChanged(QMatrixClient::Room* room)
-{
-    if( room->highlightCount() > 0 )
+    if( (changes & QuaternionRoom::HighlightChange) && room->highlightCount() > 0 )
     {
         showMessage(tr("Highlight!"), tr("%1: %2 highlight(s)").arg(room->displayName()).arg(room->highlightCount()));
         m_parent->raise();
@@ -28,6 +28,8 @@ namespace QMatrixClient
     class Room;
 }
 
+class QuaternionRoom;
+
 class SystemTray: public QSystemTrayIcon
 {
         Q_OBJECT
@@ -37,8 +39,7 @@ class SystemTray: public QSystemTrayIcon
         void setConnection(QMatrixClient::Connection* connection);
 
     private slots:
-        void newRoom(QMatrixClient::Room* room);
-        void highlightCountChanged(QMatrixClient::Room* room);
+        void roomSummaryChanged(QuaternionRoom* room, int changes);
 
     private:
         QMatrixClient::Connection* m_connection;
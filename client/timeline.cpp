@@ -0,0 +1,316 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "timeline.h"
+
+#include "message.h"
+#include "lib/events/event.h"
+
+#include <algorithm>
+
+namespace
+{
+    // New chunks are started once the edge chunk has this many messages;
+    // chunks grown by insertions in the middle are split at twice that.
+    const int ChunkSize = 256;
+
+    bool earlier(const Message* a, const Message* b)
+    {
+        return a->timestamp() < b->timestamp();
+    }
+}
+
+Timeline::Timeline()
+    : m_dirtyFrom(1)
+    , m_size(0)
+{
+}
+
+int Timeline::size() const
+{
+    return m_size;
+}
+
+bool Timeline::isEmpty() const
+{
+    return m_size == 0;
+}
+
+Message* Timeline::at(int pos) const
+{
+    const Chunk& chunk = m_chunks.at(chunkAt(pos));
+    return chunk.messages.at(m_chunks.first().start + pos - chunk.start);
+}
+
+Message* Timeline::first() const
+{
+    return m_chunks.first().messages.first();
+}
+
+Message* Timeline::last() const
+{
+    return m_chunks.last().messages.last();
+}
+
+Message* Timeline::find(const QString& eventId) const
+{
+    return m_index.value(eventId, nullptr);
+}
+
+int Timeline::indexOf(const QString& eventId) const
+{
+    Message* message = find(eventId);
+    return message ? indexOf(message) : -1;
+}
+
+int Timeline::indexOf(Message* message) const
+{
+    if( isEmpty() )
+        return -1;
+    updateStarts();
+
+    // Find the first chunk that may contain the timestamp...
+    auto chunkIt = std::lower_bound(m_chunks.begin(), m_chunks.end(), message,
+        [](const Chunk& c, const Message* m) { return earlier(c.messages.last(), m); });
+    // ...and scan the messages with the same timestamp for the pointer
+    for( ; chunkIt != m_chunks.end(); ++chunkIt )
+    {
+        const QVector<Message*>& messages = chunkIt->messages;
+        auto it = std::lower_bound(messages.begin(), messages.end(), message, earlier);
+        for( ; it != messages.end() && !earlier(message, *it); ++it )
+        {
+            if( *it == message )
+                return chunkIt->start - m_chunks.first().start + int(it - messages.begin());
+        }
+        if( it != messages.end() )
+            break;
+    }
+    return -1;
+}
+
+QList<Message*> Timeline::messagesFrom(const QString& userId) const
+{
+    return m_senderIndex.value(userId).toList();
+}
+
+int Timeline::insertionPos(Message* message) const
+{
+    if( isEmpty() || !earlier(message, last()) )
+        return m_size;
+    updateStarts();
+
+    auto chunkIt = std::upper_bound(m_chunks.begin(), m_chunks.end(), message,
+        [](const Message* m, const Chunk& c) { return earlier(m, c.messages.last()); });
+    const QVector<Message*>& messages = chunkIt->messages;
+    auto it = std::upper_bound(messages.begin(), messages.end(), message, earlier);
+    return chunkIt->start - m_chunks.first().start + int(it - messages.begin());
+}
+
+int Timeline::lowerBound(const QDateTime& timestamp) const
+{
+    if( isEmpty() || last()->timestamp() < timestamp )
+        return m_size;
+    updateStarts();
+
+    auto chunkIt = std::lower_bound(m_chunks.begin(), m_chunks.end(), timestamp,
+        [](const Chunk& c, const QDateTime& t) { return c.messages.last()->timestamp() < t; });
+    const QVector<Message*>& messages = chunkIt->messages;
+    auto it = std::lower_bound(messages.begin(), messages.end(), timestamp,
+        [](const Message* m, const QDateTime& t) { return m->timestamp() < t; });
+    return chunkIt->start - m_chunks.first().start + int(it - messages.begin());
+}
+
+int Timeline::insert(Message* message)
+{
+    if( isEmpty() || !earlier(message, last()) )
+    {
+        append(message);
+        return m_size - 1;
+    }
+    if( earlier(message, first()) )
+    {
+        prepend(message);
+        return 0;
+    }
+
+    updateStarts();
+    auto chunkIt = std::upper_bound(m_chunks.begin(), m_chunks.end(), message,
+        [](const Message* m, const Chunk& c) { return earlier(m, c.messages.last()); });
+    const int chunkIndex = int(chunkIt - m_chunks.begin());
+    Chunk& chunk = m_chunks[chunkIndex];
+    auto it = std::upper_bound(chunk.messages.begin(), chunk.messages.end(), message, earlier);
+    const int offset = int(it - chunk.messages.begin());
+    const int pos = chunk.start - m_chunks.first().start + offset;
+
+    chunk.messages.insert(offset, message);
+    ++m_size;
+    addToIndex(message);
+    invalidateFrom(chunkIndex + 1);
+    if( chunk.messages.size() > 2 * ChunkSize )
+        splitChunk(chunkIndex);
+    return pos;
+}
+
+void Timeline::append(Message* message)
+{
+    if( m_chunks.isEmpty() || m_chunks.last().messages.size() >= ChunkSize )
+    {
+        Chunk chunk;
+        chunk.start = m_chunks.isEmpty() ? 0
+                : m_chunks.last().start + m_chunks.last().messages.size();
+        m_chunks.append(chunk);
+    }
+    m_chunks.last().messages.append(message);
+    ++m_size;
+    addToIndex(message);
+}
+
+void Timeline::prepend(Message* message)
+{
+    if( m_chunks.isEmpty() || m_chunks.first().messages.size() >= ChunkSize )
+    {
+        Chunk chunk;
+        chunk.start = m_chunks.isEmpty() ? 0 : m_chunks.first().start;
+        m_chunks.prepend(chunk);
+        ++m_dirtyFrom;
+    }
+    // Moving the origin back keeps the starts of all other chunks valid
+    Chunk& chunk = m_chunks.first();
+    chunk.messages.prepend(message);
+    --chunk.start;
+    ++m_size;
+    addToIndex(message);
+}
+
+Message* Timeline::takeAt(int pos)
+{
+    const int chunkIndex = chunkAt(pos);
+    Chunk& chunk = m_chunks[chunkIndex];
+    Message* message = chunk.messages.takeAt(m_chunks.first().start + pos - chunk.start);
+    --m_size;
+    removeFromIndex(message);
+    if( chunk.messages.isEmpty() )
+    {
+        // If it was the origin, the next chunk's start is valid after
+        // chunkAt() and becomes the new origin.
+        m_chunks.removeAt(chunkIndex);
+        invalidateFrom(chunkIndex);
+    }
+    else
+        invalidateFrom(chunkIndex + 1);
+    return message;
+}
+
+QList<Message*> Timeline::takeFirst(int count)
+{
+    QList<Message*> taken;
+    while( count > 0 && !m_chunks.isEmpty() )
+    {
+        Chunk& chunk = m_chunks.first();
+        const int n = qMin(count, chunk.messages.size());
+        for( int i = 0; i < n; ++i )
+        {
+            taken.append(chunk.messages.at(i));
+            removeFromIndex(chunk.messages.at(i));
+        }
+        count -= n;
+        m_size -= n;
+        if( n == chunk.messages.size() )
+        {
+            // The next chunk becomes the origin
+            m_chunks.removeFirst();
+            m_dirtyFrom = qMax(1, m_dirtyFrom - 1);
+        }
+        else
+        {
+            chunk.messages.remove(0, n);
+            chunk.start += n;
+        }
+    }
+    return taken;
+}
+
+void Timeline::clear()
+{
+    m_chunks.clear();
+    m_index.clear();
+    m_senderIndex.clear();
+    m_size = 0;
+    m_dirtyFrom = 1;
+}
+
+void Timeline::updateStarts() const
+{
+    for( int i = qMax(1, m_dirtyFrom); i < m_chunks.size(); ++i )
+    {
+        const Chunk& previous = m_chunks.at(i - 1);
+        m_chunks[i].start = previous.start + previous.messages.size();
+    }
+    m_dirtyFrom = qMax(1, m_chunks.size());
+}
+
+int Timeline::chunkAt(int pos) const
+{
+    updateStarts();
+    const int start = m_chunks.first().start + pos;
+    auto it = std::upper_bound(m_chunks.begin(), m_chunks.end(), start,
+        [](int s, const Chunk& c) { return s < c.start; });
+    return int(it - m_chunks.begin()) - 1;
+}
+
+void Timeline::splitChunk(int chunkIndex)
+{
+    Chunk& chunk = m_chunks[chunkIndex];
+    const int half = chunk.messages.size() / 2;
+    Chunk tail;
+    tail.start = chunk.start + half;
+    tail.messages = chunk.messages.mid(half);
+    chunk.messages.resize(half);
+    m_chunks.insert(chunkIndex + 1, tail);
+    invalidateFrom(chunkIndex + 2);
+}
+
+void Timeline::invalidateFrom(int chunkIndex)
+{
+    m_dirtyFrom = qMin(m_dirtyFrom, qMax(1, chunkIndex));
+}
+
+void Timeline::addToIndex(Message* message)
+{
+    if( message->isGap() )
+        return;
+    m_index.insert(message->eventId(), message);
+    const QString senderId = message->senderId();
+    if( !senderId.isEmpty() )
+        m_senderIndex[senderId].insert(message);
+}
+
+void Timeline::removeFromIndex(Message* message)
+{
+    if( message->isGap() )
+        return;
+    m_index.remove(message->eventId());
+    auto it = m_senderIndex.find(message->senderId());
+    if( it != m_senderIndex.end() )
+    {
+        it->remove(message);
+        if( it->isEmpty() )
+            m_senderIndex.erase(it);
+    }
+}
@@ -0,0 +1,101 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+
+class Message;
+
+/**
+ * A list of messages ordered by timestamp, stored in chunks of a bounded
+ * size. Appending and prepending are O(1) amortized, inserting in the
+ * middle and finding the row of a message are O(log n). Messages are also
+ * indexed by their event id and sender. The timeline doesn't own the
+ * messages.
+ */
+class Timeline
+{
+    public:
+        Timeline();
+
+        int size() const;
+        bool isEmpty() const;
+        Message* at(int pos) const;
+        Message* first() const;
+        Message* last() const;
+
+        /** Returns the message for the given event id, or nullptr */
+        Message* find(const QString& eventId) const;
+        /** Returns the row of the message, or -1 if it's not in the timeline */
+        int indexOf(Message* message) const;
+        int indexOf(const QString& eventId) const;
+        /** Returns the messages sent by the user, in no particular order */
+        QList<Message*> messagesFrom(const QString& userId) const;
+
+        /**
+         * Returns the row at which insert() would put the message: after
+         * all messages with the same or an earlier timestamp.
+         */
+        int insertionPos(Message* message) const;
+        /**
+         * Returns the first row with a timestamp not earlier than the
+         * given one, or size() if there's none.
+         */
+        int lowerBound(const QDateTime& timestamp) const;
+        /** Inserts the message by its timestamp and returns its row */
+        int insert(Message* message);
+        void append(Message* message);
+        void prepend(Message* message);
+        Message* takeAt(int pos);
+
+        /** Removes up to count oldest messages and returns them */
+        QList<Message*> takeFirst(int count);
+        void clear();
+
+    private:
+        struct Chunk
+        {
+            // Row of the first message, relative to an arbitrary origin;
+            // the first chunk's start is always valid, the following ones
+            // only up to m_dirtyFrom.
+            int start;
+            QVector<Message*> messages;
+        };
+
+        void updateStarts() const;
+        int chunkAt(int pos) const;
+        void splitChunk(int chunkIndex);
+        void invalidateFrom(int chunkIndex);
+        void addToIndex(Message* message);
+        void removeFromIndex(Message* message);
+
+        mutable QList<Chunk> m_chunks;
+        mutable int m_dirtyFrom;
+        int m_size;
+        QHash<QString, Message*> m_index;
+        QHash<QString, QSet<Message*>> m_senderIndex;
+};
+
+#endif // TIMELINE_H
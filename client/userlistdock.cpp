@@ -21,6 +21,8 @@
 
 #include <QtWidgets/QTableView>
 #include <QtWidgets/QHeaderView>
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QVBoxLayout>
 
 #include "lib/connection.h"
 #include "lib/room.h"
@@ -37,7 +39,17 @@ UserListDock::UserListDock(QWidget* parent)
     m_view->horizontalHeader()->setStretchLastSection(true);
     m_view->horizontalHeader()->setVisible(false);
     m_view->verticalHeader()->setVisible(false);
-    setWidget(m_view);
+
+    m_filterEdit = new QLineEdit();
+    m_filterEdit->setPlaceholderText(tr("Search members"));
+    connect( m_filterEdit, &QLineEdit::textChanged, this, &UserListDock::filterChanged );
+
+    QWidget* widget = new QWidget();
+    QVBoxLayout* layout = new QVBoxLayout();
+    layout->addWidget(m_filterEdit);
+    layout->addWidget(m_view);
+    widget->setLayout(layout);
+    setWidget(widget);
 
     m_model = new UserListModel();
     m_view->setModel(m_model);
@@ -56,3 +68,8 @@ void UserListDock::setRoom(QMatrixClient::Room* room)
 {
     m_model->setRoom(room);
 }
+
+void UserListDock::filterChanged(const QString& filter)
+{
+    m_model->setFilter(filter.trimmed());
+}
@@ -29,6 +29,7 @@ namespace QMatrixClient
 }
 
 class UserListModel;
+class QLineEdit;
 class QTableView;
 
 class UserListDock: public QDockWidget
@@ -41,7 +42,11 @@ class UserListDock: public QDockWidget
         void setConnection( QMatrixClient::Connection* connection );
         void setRoom( QMatrixClient::Room* room );
 
+    private slots:
+        void filterChanged(const QString& filter);
+
     private:
+        QLineEdit* m_filterEdit;
         QTableView* m_view;
         UserListModel* m_model;
 };